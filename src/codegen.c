@@ -0,0 +1,1091 @@
+#include "codegen.h"
+#include "grammar.h"
+#include "str_buf.h"
+#include "str_table.h"
+#include "runtime.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <inttypes.h>
+
+// Contents of 'runtime.h', embedded by the build system
+extern const char runtime_data[];
+
+// Programs combined in a module (see emit_c_module) share a single blob of
+// strings, and use the option and short option tables of the first program
+// that has the same ones. Programs can also use a prefix of an option table,
+// since options are placed first in result structures. Programs are emitted
+// by decreasing number of options, so that larger tables are defined first.
+typedef struct Module {
+    const char* name;
+    StrTable strings;
+    size_t* order;
+    const char** option_owners;
+    const char** short_owners;
+    size_t current;
+} Module;
+
+void print_upper(StrBuf* buf, const char* str) {
+    for (; *str; ++str)
+        append_char(buf, isalnum(*str) ? toupper(*str) : '_');
+}
+
+void print_c_str(StrBuf* buf, const char* str, size_t len) {
+    append_char(buf, '"');
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = str[i];
+        switch (c) {
+            case '\n': append_fmt(buf, "\\n");  break;
+            case '\t': append_fmt(buf, "\\t");  break;
+            case '\\': append_fmt(buf, "\\\\"); break;
+            case '"':  append_fmt(buf, "\\\""); break;
+            default:
+                if (isprint(c))
+                    append_char(buf, c);
+                else
+                    append_fmt(buf, "\\%03o", c);
+                break;
+        }
+    }
+    append_char(buf, '"');
+}
+
+static void print_str(StrBuf* buf, const Module* module, const char* str) {
+    uint32_t offset;
+    if (module && find_in_str_table(&module->strings, str, &offset))
+        append_fmt(buf, "%s_strings + %"PRIu32, module->name, offset);
+    else
+        print_c_str(buf, str, strlen(str));
+}
+
+static const char* get_option_owner(const Grammar* grammar, const Module* module) {
+    return module ? module->option_owners[module->current] : grammar->prog;
+}
+
+static const char* get_short_owner(const Grammar* grammar, const Module* module) {
+    return module ? module->short_owners[module->current] : grammar->prog;
+}
+
+void print_doc(StrBuf* buf, const char* doc) {
+    if (!*doc)
+        append_fmt(buf, "\n    \"\"");
+    while (*doc) {
+        size_t len = strcspn(doc, "\n");
+        len += doc[len] == '\n';
+        append_fmt(buf, "\n    ");
+        print_c_str(buf, doc, len);
+        doc += len;
+    }
+}
+
+static void print_choice_name(StrBuf* buf, const char* prog, const Option* option, size_t choice) {
+    print_upper(buf, prog);
+    append_char(buf, '_');
+    print_upper(buf, option->field + 4);
+    append_char(buf, '_');
+    print_upper(buf, option->choices[choice]);
+}
+
+static const char* get_option_kind(const Option* option) {
+    if (!option->arg)
+        return option->is_repeated ? "DOCOPT_COUNT" : "DOCOPT_FLAG";
+    switch (option->arg_type) {
+        case ARG_TYPE_INT:    return "DOCOPT_INT";
+        case ARG_TYPE_FLOAT:  return "DOCOPT_FLOAT";
+        case ARG_TYPE_BOOL:   return "DOCOPT_BOOL";
+        case ARG_TYPE_CHOICE: return "DOCOPT_CHOICE";
+        default:              return "DOCOPT_STRING";
+    }
+}
+
+static const char* get_option_type(const Option* option) {
+    if (!option->arg)
+        return option->is_repeated ? "unsigned " : "bool ";
+    switch (option->arg_type) {
+        case ARG_TYPE_INT:    return "long long ";
+        case ARG_TYPE_FLOAT:  return "double ";
+        case ARG_TYPE_BOOL:   return "bool ";
+        case ARG_TYPE_CHOICE: return "int ";
+        default:              return "const char* ";
+    }
+}
+
+static const char* get_positional_kind(const Positional* positional) {
+    if (positional->is_command)
+        return positional->is_repeated ? "DOCOPT_COMMAND_COUNT" : "DOCOPT_COMMAND";
+    return positional->is_repeated ? "DOCOPT_ARG_LIST" : "DOCOPT_ARG";
+}
+
+static const char* get_positional_type(const Positional* positional) {
+    if (positional->is_command)
+        return positional->is_repeated ? "unsigned " : "bool ";
+    return positional->is_repeated ? "DocoptList " : "const char* ";
+}
+
+static const char* get_node_tag_name(NodeTag tag) {
+    switch (tag) {
+        case NODE_COMMAND:  return "DOCOPT_NODE_COMMAND";
+        case NODE_ARG:      return "DOCOPT_NODE_ARG";
+        case NODE_OPTION:   return "DOCOPT_NODE_OPTION";
+        case NODE_SEQ:      return "DOCOPT_NODE_SEQ";
+        case NODE_OPTIONAL: return "DOCOPT_NODE_OPTIONAL";
+        case NODE_OR:       return "DOCOPT_NODE_OR";
+        case NODE_REPEAT:   return "DOCOPT_NODE_REPEAT";
+        case NODE_ANY_OPTIONS: return "DOCOPT_NODE_ANY_OPTIONS";
+        default:
+            assert(false && "invalid node tag");
+            return "";
+    }
+}
+
+void print_default_val(StrBuf* buf, const char* prog, const Option* option) {
+    const char* val = option->default_val;
+    switch (option->arg_type) {
+        case ARG_TYPE_INT: {
+            // Default values are checked to be in range, and leading zeros must not be printed
+            long long int_val = strtoll(val, NULL, 10);
+            if (int_val == LLONG_MIN)
+                append_fmt(buf, "(-%lldLL - 1)", LLONG_MAX);
+            else
+                append_fmt(buf, "%lldLL", int_val);
+            break;
+        }
+        case ARG_TYPE_FLOAT: {
+            double float_val = 0;
+            docopt_parse_float(val, &float_val);
+            append_fmt(buf, "%.17g", float_val);
+            break;
+        }
+        case ARG_TYPE_BOOL: {
+            bool bool_val = false;
+            docopt_parse_bool(val, &bool_val);
+            append_fmt(buf, "%s", bool_val ? "true" : "false");
+            break;
+        }
+        case ARG_TYPE_CHOICE:
+            for (size_t i = 0; i < option->choice_count; ++i) {
+                if (!strcmp(option->choices[i], val))
+                    print_choice_name(buf, prog, option, i);
+            }
+            break;
+        default:
+            print_c_str(buf, val, strlen(val));
+            break;
+    }
+}
+
+static void emit_choices(StrBuf* buf, const Grammar* grammar, const Module* module) {
+    bool has_options = get_option_owner(grammar, module) == grammar->prog;
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        if (!option->arg || option->arg_type != ARG_TYPE_CHOICE)
+            continue;
+        append_fmt(buf, "enum {\n");
+        for (size_t j = 0; j < option->choice_count; ++j) {
+            append_fmt(buf, "    ");
+            print_choice_name(buf, grammar->prog, option, j);
+            append_fmt(buf, "%s\n", j + 1 < option->choice_count ? "," : "");
+        }
+        append_fmt(buf, "};\n\n");
+        if (!has_options)
+            continue;
+        append_fmt(buf, "static const char* const %s_%s_choices[] = {", grammar->prog, option->field);
+        for (size_t j = 0; j < option->choice_count; ++j) {
+            append_fmt(buf, "%s", j == 0 ? " " : ", ");
+            print_str(buf, module, option->choices[j]);
+        }
+        append_fmt(buf, " };\n\n");
+    }
+}
+
+static void emit_positional_fields(StrBuf* buf, const Grammar* grammar) {
+    for (size_t i = 0; i < grammar->positional_count; ++i) {
+        const Positional* positional = &grammar->positionals[i];
+        append_fmt(buf, "    %s%s;\n", get_positional_type(positional), positional->field);
+    }
+}
+
+static void emit_struct(StrBuf* buf, const Grammar* grammar, const Module* module) {
+    append_fmt(buf, "typedef struct %s_args {\n", grammar->prog);
+    if (!module)
+        emit_positional_fields(buf, grammar);
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        append_fmt(buf, "    %s%s;\n", get_option_type(option), option->field);
+    }
+    if (module)
+        emit_positional_fields(buf, grammar);
+    append_fmt(buf, "    DocoptMem* mem;\n");
+    append_fmt(buf, "    char error[DOCOPT_ERROR_SIZE];\n");
+    append_fmt(buf, "} %s_args;\n\n", grammar->prog);
+}
+
+static void emit_defaults(StrBuf* buf, const Grammar* grammar) {
+    append_fmt(buf, "static const %s_args %s_defaults = {\n    .mem = NULL", grammar->prog, grammar->prog);
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        if (!option->arg || !option->default_val)
+            continue;
+        append_fmt(buf, ",\n    .%s = ", option->field);
+        print_default_val(buf, grammar->prog, option);
+    }
+    append_fmt(buf, "\n};\n\n");
+}
+
+static void print_char(StrBuf* buf, char c) {
+    if (!c)
+        append_fmt(buf, "0");
+    else
+        append_fmt(buf, "'%s%c'", c == '\\' || c == '\'' ? "\\" : "", c);
+}
+
+static bool has_long_options(const Grammar* grammar) {
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        if (grammar->options[i].long_name)
+            return true;
+    }
+    return false;
+}
+
+typedef struct LongName {
+    size_t len;
+    size_t option;
+} LongName;
+
+static int compare_long_names(const void* a, const void* b) {
+    const LongName* x = a;
+    const LongName* y = b;
+    if (x->len != y->len)
+        return x->len < y->len ? -1 : 1;
+    return x->option < y->option ? -1 : x->option > y->option;
+}
+
+// Long options are looked up with a switch on their length, followed by
+// comparisons with the few candidates of that length. Cases are emitted in
+// order of length, and candidates in the order of the option table.
+static void emit_find_long(StrBuf* buf, const Grammar* grammar, const char* option_owner) {
+    if (!has_long_options(grammar))
+        return;
+    LongName* names = malloc(sizeof(LongName) * grammar->option_count);
+    size_t name_count = 0;
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        if (grammar->options[i].long_name)
+            names[name_count++] = (LongName) { .len = strlen(grammar->options[i].long_name), .option = i };
+    }
+    qsort(names, name_count, sizeof(LongName), compare_long_names);
+
+    append_fmt(buf,
+        "static const DocoptOption* %s_find_long(const char* name, size_t len) {\n"
+        "    switch (len) {\n", grammar->prog);
+    for (size_t i = 0; i < name_count; ++i) {
+        size_t len = names[i].len;
+        if (i == 0 || names[i - 1].len != len)
+            append_fmt(buf, "        case %zu:\n", len);
+        append_fmt(buf, "            if (!memcmp(name, ");
+        print_c_str(buf, grammar->options[names[i].option].long_name, len);
+        append_fmt(buf, ", %zu))\n                return &%s_options[%zu];\n", len, option_owner, names[i].option);
+        if (i + 1 == name_count || names[i + 1].len != len)
+            append_fmt(buf, "            break;\n");
+    }
+    free(names);
+    append_fmt(buf,
+        "    }\n"
+        "    return NULL;\n"
+        "}\n\n");
+}
+
+// Nodes that consume options must undo their marks when they fail, and only
+// those get the code to do so
+typedef struct MatcherWriter {
+    StrBuf* buf;
+    const Grammar* grammar;
+    bool* is_function;
+    bool* has_options;
+    size_t var_count;
+} MatcherWriter;
+
+static void print_indent(StrBuf* buf, int indent) {
+    for (int i = 0; i < indent; ++i)
+        append_fmt(buf, "    ");
+}
+
+static void emit_match_code(MatcherWriter*, size_t node, const char* pos, int indent);
+
+static void emit_match_call(MatcherWriter* writer, size_t node, const char* pos, const char* result, int indent) {
+    print_indent(writer->buf, indent);
+    append_fmt(writer->buf, "%s = %s_match_%zu(match, %s);\n", result, writer->grammar->prog, node, pos);
+}
+
+// Emits code that matches the given node at position `pos`, and that updates
+// `pos` with the position after the match, or DOCOPT_FAIL. Composite nodes are
+// only matched when `pos` may have failed before.
+static void emit_child_code(MatcherWriter* writer, size_t node, const char* pos, bool may_fail, int indent) {
+    NodeTag tag = writer->grammar->nodes[node].tag;
+    bool is_leaf = tag == NODE_COMMAND || tag == NODE_ARG || tag == NODE_OPTION || tag == NODE_ANY_OPTIONS;
+    if (!may_fail && writer->is_function[node])
+        emit_match_call(writer, node, pos, pos, indent);
+    else if (!may_fail || (is_leaf && !writer->is_function[node])) {
+        emit_match_code(writer, node, pos, indent);
+    } else {
+        print_indent(writer->buf, indent);
+        append_fmt(writer->buf, "if (%s != DOCOPT_FAIL) {\n", pos);
+        if (writer->is_function[node])
+            emit_match_call(writer, node, pos, pos, indent + 1);
+        else
+            emit_match_code(writer, node, pos, indent + 1);
+        print_indent(writer->buf, indent);
+        append_fmt(writer->buf, "}\n");
+    }
+}
+
+static void emit_match_code(MatcherWriter* writer, size_t index, const char* pos, int indent) {
+    StrBuf* buf = writer->buf;
+    const Grammar* grammar = writer->grammar;
+    const Node* node = &grammar->nodes[index];
+    size_t end = index + node->size;
+    size_t var = writer->var_count++;
+    switch (node->tag) {
+        case NODE_COMMAND:
+        case NODE_ARG:
+            print_indent(buf, indent);
+            append_fmt(buf, "if (%s < match->pos_count", pos);
+            if (node->tag == NODE_COMMAND) {
+                const char* name = grammar->positionals[node->index].name;
+                append_fmt(buf, " && !strcmp(match->pos[%s].str, ", pos);
+                print_c_str(buf, name, strlen(name));
+                append_char(buf, ')');
+            }
+            append_fmt(buf, ")\n");
+            print_indent(buf, indent + 1);
+            append_fmt(buf, "match->pos[%s++].slot = %"PRIu32";\n", pos, node->index);
+            print_indent(buf, indent);
+            append_fmt(buf, "else\n");
+            print_indent(buf, indent + 1);
+            append_fmt(buf, "%s = DOCOPT_FAIL;\n", pos);
+            break;
+        case NODE_OPTION:
+            print_indent(buf, indent);
+            append_fmt(buf, "if (match->given[%"PRIu32"])\n", node->index);
+            print_indent(buf, indent + 1);
+            append_fmt(buf, "docopt_use_option(match, %"PRIu32");\n", node->index);
+            print_indent(buf, indent);
+            append_fmt(buf, "else\n");
+            print_indent(buf, indent + 1);
+            append_fmt(buf, "%s = DOCOPT_FAIL;\n", pos);
+            break;
+        case NODE_ANY_OPTIONS:
+            print_indent(buf, indent);
+            append_fmt(buf, "docopt_use_option(match, %zu);\n", grammar->option_count);
+            break;
+        case NODE_SEQ:
+            for (size_t child = index + 1; child < end; child += grammar->nodes[child].size)
+                emit_child_code(writer, child, pos, child != index + 1, indent);
+            break;
+        case NODE_OPTIONAL:
+            for (size_t child = index + 1; child < end; child += grammar->nodes[child].size) {
+                print_indent(buf, indent);
+                append_fmt(buf, "{\n");
+                print_indent(buf, indent + 1);
+                append_fmt(buf, "size_t pos%zu = %s;\n", var, pos);
+                if (writer->has_options[child]) {
+                    print_indent(buf, indent + 1);
+                    append_fmt(buf, "size_t used%zu = match->used_count;\n", var);
+                }
+                char child_pos[32];
+                snprintf(child_pos, sizeof(child_pos), "pos%zu", var);
+                emit_child_code(writer, child, child_pos, false, indent + 1);
+                print_indent(buf, indent + 1);
+                append_fmt(buf, "if (pos%zu != DOCOPT_FAIL)\n", var);
+                print_indent(buf, indent + 2);
+                append_fmt(buf, "%s = pos%zu;\n", pos, var);
+                if (writer->has_options[child]) {
+                    print_indent(buf, indent + 1);
+                    append_fmt(buf, "else\n");
+                    print_indent(buf, indent + 2);
+                    append_fmt(buf, "docopt_undo_options(match, used%zu);\n", var);
+                }
+                print_indent(buf, indent);
+                append_fmt(buf, "}\n");
+            }
+            break;
+        case NODE_OR: {
+            // Alternatives are matched by separate functions, since the best one is matched again to restore its
+            // slots and options. Ties are broken by the number of consumed options, as in the runtime.
+            char child_pos[32], best_pos[32], best[32];
+            snprintf(child_pos, sizeof(child_pos), "pos%zu", var);
+            snprintf(best_pos, sizeof(best_pos), "best_pos%zu", var);
+            snprintf(best, sizeof(best), "best%zu", var);
+            bool has_options = writer->has_options[index];
+            print_indent(buf, indent);
+            append_fmt(buf, "size_t %s, %s = DOCOPT_FAIL, %s = 0;\n", child_pos, best_pos, best);
+            if (has_options) {
+                print_indent(buf, indent);
+                append_fmt(buf, "size_t used%zu = match->used_count, best_used%zu = 0;\n", var, var);
+            }
+            size_t last_child = index + 1, child_count = 0;
+            for (size_t child = index + 1; child < end; child += grammar->nodes[child].size)
+                last_child = child, child_count++;
+            for (size_t child = index + 1, i = 0; child < end; child += grammar->nodes[child].size, ++i) {
+                emit_match_call(writer, child, pos, child_pos, indent);
+                print_indent(buf, indent);
+                append_fmt(buf, "if (%s != DOCOPT_FAIL && (%s == DOCOPT_FAIL || %s > %s", child_pos, best_pos, child_pos, best_pos);
+                if (has_options)
+                    append_fmt(buf, " || (%s == %s && match->used_count > best_used%zu)", child_pos, best_pos, var);
+                append_fmt(buf, "))\n");
+                print_indent(buf, indent + 1);
+                append_fmt(buf, "%s = %s, %s = %zu", best_pos, child_pos, best, i);
+                if (has_options)
+                    append_fmt(buf, ", best_used%zu = match->used_count", var);
+                append_fmt(buf, ";\n");
+                if (has_options && child != last_child) {
+                    print_indent(buf, indent);
+                    append_fmt(buf, "docopt_undo_options(match, used%zu);\n", var);
+                }
+            }
+            if (has_options) {
+                print_indent(buf, indent);
+                append_fmt(buf, "if (%s != DOCOPT_FAIL && %s != %zu)\n", best_pos, best, child_count - 1);
+                print_indent(buf, indent + 1);
+                append_fmt(buf, "docopt_undo_options(match, used%zu);\n", var);
+            }
+            for (size_t child = index + 1, i = 0; child < last_child; child += grammar->nodes[child].size, ++i) {
+                print_indent(buf, indent);
+                append_fmt(buf, "%sif (%s == %zu)\n", i == 0 ? "" : "else ", best, i);
+                emit_match_call(writer, child, pos, child_pos, indent + 1);
+            }
+            print_indent(buf, indent);
+            append_fmt(buf, "%s = %s;\n", pos, best_pos);
+            break;
+        }
+        case NODE_REPEAT: {
+            char child_pos[32];
+            snprintf(child_pos, sizeof(child_pos), "pos%zu", var);
+            print_indent(buf, indent);
+            if (!writer->has_options[index]) {
+                append_fmt(buf, "size_t %s;\n", child_pos);
+                emit_match_call(writer, index + 1, pos, pos, indent);
+                print_indent(buf, indent);
+                append_fmt(buf, "while (%s != DOCOPT_FAIL && (%s = %s_match_%zu(match, %s)) != DOCOPT_FAIL && %s != %s)\n",
+                    pos, child_pos, grammar->prog, index + 1, pos, child_pos, pos);
+                print_indent(buf, indent + 1);
+                append_fmt(buf, "%s = %s;\n", pos, child_pos);
+                break;
+            }
+            // The marks of the last, failed repetition are undone
+            append_fmt(buf, "size_t %s = DOCOPT_FAIL, used%zu = 0;\n", child_pos, var);
+            emit_match_call(writer, index + 1, pos, pos, indent);
+            print_indent(buf, indent);
+            append_fmt(buf, "while (%s != DOCOPT_FAIL && (used%zu = match->used_count, %s = %s_match_%zu(match, %s)) != DOCOPT_FAIL && %s != %s)\n",
+                pos, var, child_pos, grammar->prog, index + 1, pos, child_pos, pos);
+            print_indent(buf, indent + 1);
+            append_fmt(buf, "%s = %s;\n", pos, child_pos);
+            print_indent(buf, indent);
+            append_fmt(buf, "if (%s != DOCOPT_FAIL && %s == DOCOPT_FAIL)\n", pos, child_pos);
+            print_indent(buf, indent + 1);
+            append_fmt(buf, "docopt_undo_options(match, used%zu);\n", var);
+            break;
+        }
+        default:
+            assert(false && "invalid node tag");
+            break;
+    }
+}
+
+// Parsers generated for speed match each usage with specialized code. Usages,
+// and children of alternatives and repetitions, which are matched several
+// times, get their own function. Functions are emitted in reverse pre-order,
+// so that they are defined before being called.
+static size_t emit_matchers(StrBuf* buf, const Grammar* grammar) {
+    bool* is_function = calloc(grammar->node_count, sizeof(bool));
+    bool* has_options = calloc(grammar->node_count, sizeof(bool));
+    for (size_t i = 0; i < grammar->usage_count; ++i)
+        is_function[grammar->usages[i]] = true;
+    for (size_t i = grammar->node_count; i-- > 0;) {
+        const Node* node = &grammar->nodes[i];
+        has_options[i] = node->tag == NODE_OPTION || node->tag == NODE_ANY_OPTIONS;
+        for (size_t child = i + 1; child < i + node->size; child += grammar->nodes[child].size) {
+            has_options[i] |= has_options[child];
+            if (node->tag == NODE_OR || node->tag == NODE_REPEAT)
+                is_function[child] = true;
+        }
+    }
+
+    size_t function_count = 0;
+    MatcherWriter writer = { .buf = buf, .grammar = grammar, .is_function = is_function, .has_options = has_options };
+    for (size_t i = grammar->node_count; i-- > 0;) {
+        if (!is_function[i])
+            continue;
+        bool uses_match = false;
+        for (size_t j = i; j < i + grammar->nodes[i].size && !uses_match; ++j)
+            uses_match = grammar->nodes[j].tag != NODE_SEQ && grammar->nodes[j].tag != NODE_OPTIONAL;
+        append_fmt(buf, "static size_t %s_match_%zu(DocoptMatch* match, size_t pos) {\n", grammar->prog, i);
+        if (!uses_match)
+            append_fmt(buf, "    (void)match;\n");
+        writer.var_count = 0;
+        emit_match_code(&writer, i, "pos", 1);
+        append_fmt(buf, "    return pos;\n}\n\n");
+        function_count++;
+    }
+
+    append_fmt(buf, "static const DocoptMatcher %s_matchers[] = {", grammar->prog);
+    for (size_t i = 0; i < grammar->usage_count; ++i)
+        append_fmt(buf, "%s%s_match_%zu", i == 0 ? " " : ", ", grammar->prog, grammar->usages[i]);
+    append_fmt(buf, " };\n\n");
+    free(is_function);
+    free(has_options);
+    return function_count;
+}
+
+static bool is_exit_option(const Option* option) {
+    if (option->arg)
+        return false;
+    if (option->long_name)
+        return !strcmp(option->long_name, "help") || !strcmp(option->long_name, "version");
+    return option->short_name == 'h';
+}
+
+// Bit masks of the numbers of positional arguments that a node can match when
+// no option is given
+enum {
+    ARGS_NONE = 1,
+    ARGS_ONE  = 2,
+    ARGS_MORE = 4
+};
+
+static unsigned add_arg_counts(unsigned a, unsigned b) {
+    unsigned sum = 0;
+    for (unsigned i = 0; i < 3; ++i) {
+        for (unsigned j = 0; j < 3; ++j) {
+            if ((a >> i & 1) && (b >> j & 1))
+                sum |= 1u << (i + j < 2 ? i + j : 2);
+        }
+    }
+    return sum;
+}
+
+static unsigned get_arg_counts(const Grammar* grammar, size_t index) {
+    const Node* node = &grammar->nodes[index];
+    size_t end = index + node->size;
+    unsigned counts = node->tag == NODE_OR ? 0 : ARGS_NONE;
+    switch (node->tag) {
+        case NODE_COMMAND: // fallthrough
+        case NODE_ARG:     return ARGS_ONE;
+        case NODE_OPTION:  return 0;
+        case NODE_ANY_OPTIONS: return ARGS_NONE;
+        case NODE_SEQ:
+            for (size_t child = index + 1; child < end; child += grammar->nodes[child].size)
+                counts = add_arg_counts(counts, get_arg_counts(grammar, child));
+            return counts;
+        case NODE_OPTIONAL:
+            for (size_t child = index + 1; child < end; child += grammar->nodes[child].size)
+                counts = add_arg_counts(counts, get_arg_counts(grammar, child) | ARGS_NONE);
+            return counts;
+        case NODE_OR:
+            for (size_t child = index + 1; child < end; child += grammar->nodes[child].size)
+                counts |= get_arg_counts(grammar, child);
+            return counts;
+        case NODE_REPEAT: {
+            // Two more repetitions are enough for the counts to saturate
+            unsigned child_counts = get_arg_counts(grammar, index + 1);
+            counts = child_counts;
+            for (int i = 0; i < 2; ++i)
+                counts |= add_arg_counts(counts, child_counts);
+            return counts;
+        }
+    }
+    return 0;
+}
+
+// Usages such as 'prog <file>' are matched directly when they are the first
+// ones that can match a single argument, since they then always match it.
+// Returns the positional index of the argument, or -1.
+static int find_single_arg(const Grammar* grammar) {
+    for (size_t i = 0; i < grammar->usage_count; ++i) {
+        size_t usage = grammar->usages[i];
+        if (!(get_arg_counts(grammar, usage) & ARGS_ONE))
+            continue;
+        const Node* node = &grammar->nodes[usage];
+        if (node->tag == NODE_SEQ) {
+            // The '[options]' shortcut matches no argument
+            const Node* child = NULL;
+            size_t child_count = 0;
+            for (size_t j = usage + 1; j < usage + node->size; j += grammar->nodes[j].size) {
+                if (grammar->nodes[j].tag != NODE_ANY_OPTIONS)
+                    child = &grammar->nodes[j], child_count++;
+            }
+            if (child_count == 1)
+                node = child;
+        }
+        if (node->tag != NODE_ARG || grammar->positionals[node->index].is_repeated)
+            return -1;
+        return (int)node->index;
+    }
+    return -1;
+}
+
+// Returns the number of exit options
+static size_t emit_exit_options(StrBuf* buf, const Grammar* grammar) {
+    size_t count = 0;
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        if (!is_exit_option(&grammar->options[i]))
+            continue;
+        if (count++ == 0)
+            append_fmt(buf, "static const unsigned %s_exit_options[] = { %zu", grammar->prog, i);
+        else
+            append_fmt(buf, ", %zu", i);
+    }
+    if (count > 0)
+        append_fmt(buf, " };\n\n");
+    return count;
+}
+
+static void emit_early_fields(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options, size_t exit_option_count) {
+    if (exit_option_count > 0)
+        append_fmt(buf, "    .exit_options = %s_exit_options,\n    .exit_option_count = %zu,\n", grammar->prog, exit_option_count);
+
+    bool accepts_empty = false;
+    for (size_t i = 0; i < grammar->usage_count && !accepts_empty; ++i)
+        accepts_empty = get_arg_counts(grammar, grammar->usages[i]) & ARGS_NONE;
+    if (accepts_empty)
+        append_fmt(buf, "    .accepts_empty = true,\n");
+
+    // Response files would have to be expanded first
+    int single_arg = options->response_files ? -1 : find_single_arg(grammar);
+    if (single_arg >= 0)
+        append_fmt(buf, "    .single_arg = &%s_positionals[%d],\n", grammar->prog, single_arg);
+}
+
+// Returns the number of matcher functions
+static size_t emit_tables(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options, const Module* module) {
+    const char* prog = grammar->prog;
+    const char* option_owner = get_option_owner(grammar, module);
+    const char* short_owner = get_short_owner(grammar, module);
+    if (grammar->option_count > 0 && option_owner != prog) {
+        // Offsets are the same when the types of the previous options are
+        append_fmt(buf, "_Static_assert(offsetof(%s_args, %s) == offsetof(%s_args, %s), \"shared options\");\n\n",
+            prog, grammar->options[grammar->option_count - 1].field,
+            option_owner, grammar->options[grammar->option_count - 1].field);
+    } else if (grammar->option_count > 0) {
+        append_fmt(buf, "static const DocoptOption %s_options[] = {\n", prog);
+        for (size_t i = 0; i < grammar->option_count; ++i) {
+            const Option* option = &grammar->options[i];
+            append_fmt(buf, "    { ");
+            if (option->long_name)
+                print_str(buf, module, option->long_name);
+            else
+                append_fmt(buf, "NULL");
+            append_fmt(buf, ", ");
+            print_char(buf, option->short_name);
+            append_fmt(buf, ", %s, %s, offsetof(%s_args, %s), ", get_option_kind(option),
+                option->is_in_usage ? "true" : "false", prog, option->field);
+            if (option->arg && option->arg_type == ARG_TYPE_CHOICE)
+                append_fmt(buf, "%s_%s_choices, %zu }", prog, option->field, option->choice_count);
+            else
+                append_fmt(buf, "NULL, 0 }");
+            append_fmt(buf, "%s\n", i + 1 < grammar->option_count ? "," : "");
+        }
+        append_fmt(buf, "};\n\n");
+    }
+
+    // Short options are dispatched through a table indexed by character, so that
+    // bundles such as '-abc' are handled without any string comparison. Parsers
+    // generated for size search the option table instead.
+    if (options->opt_level != OPT_SIZE && short_owner == prog) {
+        append_fmt(buf, "static const DocoptShort %s_shorts[256] = {", prog);
+        bool has_shorts = false;
+        for (size_t i = 0; i < grammar->option_count; ++i) {
+            const Option* option = &grammar->options[i];
+            if (!option->short_name)
+                continue;
+            append_fmt(buf, "%s\n    [", has_shorts ? "," : "");
+            print_char(buf, option->short_name);
+            append_fmt(buf, "] = { %s, %zu }", option->arg ? "DOCOPT_SHORT_VALUE" : "DOCOPT_SHORT_FLAG", i);
+            has_shorts = true;
+        }
+        append_fmt(buf, has_shorts ? "\n};\n\n" : " { 0, 0 } };\n\n");
+    }
+
+    if (grammar->positional_count > 0) {
+        append_fmt(buf, "static const DocoptPositional %s_positionals[] = {\n", prog);
+        for (size_t i = 0; i < grammar->positional_count; ++i) {
+            const Positional* positional = &grammar->positionals[i];
+            append_fmt(buf, "    { ");
+            if (positional->is_command)
+                print_str(buf, module, positional->name);
+            else
+                append_fmt(buf, "NULL");
+            append_fmt(buf, ", %s, offsetof(%s_args, %s) }%s\n",
+                get_positional_kind(positional), prog, positional->field,
+                i + 1 < grammar->positional_count ? "," : "");
+        }
+        append_fmt(buf, "};\n\n");
+    }
+
+    size_t function_count = 0;
+    if (options->opt_level == OPT_SPEED) {
+        emit_find_long(buf, grammar, option_owner);
+        function_count = emit_matchers(buf, grammar);
+    } else {
+        append_fmt(buf, "static const DocoptNode %s_nodes[] = {\n", prog);
+        for (size_t i = 0; i < grammar->node_count; ++i) {
+            const Node* node = &grammar->nodes[i];
+            append_fmt(buf, "    { %s, %"PRIu32", %"PRIu32" }%s\n",
+                get_node_tag_name(node->tag), node->index, node->size,
+                i + 1 < grammar->node_count ? "," : "");
+        }
+        append_fmt(buf, "};\n\n");
+
+        append_fmt(buf, "static const unsigned %s_usages[] = {", prog);
+        for (size_t i = 0; i < grammar->usage_count; ++i)
+            append_fmt(buf, "%s%zu", i == 0 ? " " : ", ", grammar->usages[i]);
+        append_fmt(buf, " };\n\n");
+    }
+
+    // Instrumented parsers record the usage of every command line
+    size_t exit_option_count = options->instrument ? 0 : emit_exit_options(buf, grammar);
+
+    if (options->instrument) {
+        append_fmt(buf, "static unsigned long long %s_usage_counts[%zu];\n", prog, grammar->usage_count);
+        if (grammar->option_count > 0)
+            append_fmt(buf, "static unsigned long long %s_option_counts[%zu];\n", prog, grammar->option_count);
+        append_fmt(buf,
+            "static void dump_%s_profile(void);\n"
+            "static DocoptProfile %s_profile = {\n"
+            "    .file_name = \"%s.profile\",\n"
+            "    .usage_counts = %s_usage_counts,\n", prog, prog, prog, prog);
+        if (grammar->option_count > 0)
+            append_fmt(buf, "    .option_counts = %s_option_counts,\n", prog);
+        append_fmt(buf, "    .dump = dump_%s_profile\n};\n\n", prog);
+    }
+
+    append_fmt(buf, "static const DocoptSpec %s_spec = {\n    .prog = ", prog);
+    print_str(buf, module, prog);
+    append_fmt(buf, ",\n");
+    if (grammar->option_count > 0)
+        append_fmt(buf, "    .options = %s_options,\n    .option_count = %zu,\n", option_owner, grammar->option_count);
+    if (options->opt_level != OPT_SIZE)
+        append_fmt(buf, "    .shorts = %s_shorts,\n", short_owner);
+    if (grammar->positional_count > 0)
+        append_fmt(buf, "    .positionals = %s_positionals,\n    .positional_count = %zu,\n", prog, grammar->positional_count);
+    if (options->opt_level == OPT_SPEED) {
+        append_fmt(buf, "    .matchers = %s_matchers,\n", prog);
+        if (has_long_options(grammar))
+            append_fmt(buf, "    .find_long = %s_find_long,\n", prog);
+    } else
+        append_fmt(buf, "    .nodes = %s_nodes,\n    .usages = %s_usages,\n", prog, prog);
+    if (!options->instrument)
+        emit_early_fields(buf, grammar, options, exit_option_count);
+    append_fmt(buf,
+        "    .usage_count = %zu,\n"
+        "    .response_files = %s",
+        grammar->usage_count, options->response_files ? "true" : "false");
+    if (options->instrument)
+        append_fmt(buf, ",\n    .profile = &%s_profile", prog);
+    append_fmt(buf, "\n};\n\n");
+
+    if (options->instrument) {
+        append_fmt(buf,
+            "static void dump_%s_profile(void) {\n"
+            "    docopt_dump_profile(&%s_spec);\n"
+            "}\n\n", prog, prog);
+    }
+    return function_count;
+}
+
+static void emit_entry_points(StrBuf* buf, const Grammar* grammar) {
+    const char* prog = grammar->prog;
+    append_fmt(buf,
+        "static inline int parse_%s_args(%s_args* args, int argc, char** argv) {\n"
+        "    *args = %s_defaults;\n"
+        "    return docopt_parse(&%s_spec, args, &args->mem, args->error, argc - 1, argv + 1);\n"
+        "}\n\n",
+        prog, prog, prog, prog);
+    append_fmt(buf,
+        "static inline int parse_%s_args_from_str(%s_args* args, char* str, char** tokens, int max_tokens) {\n"
+        "    *args = %s_defaults;\n"
+        "    int count = docopt_split(str, tokens, max_tokens, args->error);\n"
+        "    if (count < 0)\n"
+        "        return DOCOPT_ERROR;\n"
+        "    return docopt_parse(&%s_spec, args, &args->mem, args->error, count, tokens);\n"
+        "}\n\n",
+        prog, prog, prog, prog);
+    append_fmt(buf,
+        "static inline void free_%s_args(%s_args* args) {\n"
+        "    docopt_free(args->mem);\n"
+        "}\n\n",
+        prog, prog);
+}
+
+// Returns the number of matcher functions
+static size_t emit_program(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options, const Module* module) {
+    emit_choices(buf, grammar, module);
+    emit_struct(buf, grammar, module);
+    append_fmt(buf, "static const char %s_doc[] =", grammar->prog);
+    print_doc(buf, grammar->doc);
+    append_fmt(buf, ";\n\n");
+    emit_defaults(buf, grammar);
+    size_t function_count = emit_tables(buf, grammar, options, module);
+    emit_entry_points(buf, grammar);
+    return function_count;
+}
+
+void emit_c_code(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options) {
+    append_fmt(buf, "// Generated by docoptc. Do not edit.\n");
+    append_fmt(buf, "#ifndef ");
+    print_upper(buf, grammar->prog);
+    append_fmt(buf, "_ARGS_H\n#define ");
+    print_upper(buf, grammar->prog);
+    append_fmt(buf, "_ARGS_H\n\n");
+    append_fmt(buf, "%s\n", runtime_data);
+    size_t start = buf->size;
+
+    size_t function_count = emit_program(buf, grammar, options, NULL);
+    if (options->stats) {
+        options->stats->code_size = buf->size - start;
+        options->stats->state_count = grammar->node_count;
+        options->stats->function_count = function_count;
+    }
+
+    append_fmt(buf, "#endif\n");
+}
+
+static bool options_equal(const Option* a, const Option* b) {
+    const char* kind = get_option_kind(a);
+    if (strcmp(a->field, b->field) ||
+        (a->long_name && b->long_name ? strcmp(a->long_name, b->long_name) : a->long_name != b->long_name) ||
+        a->short_name != b->short_name ||
+        a->is_in_usage != b->is_in_usage ||
+        strcmp(kind, get_option_kind(b)))
+        return false;
+    if (strcmp(kind, "DOCOPT_CHOICE"))
+        return true;
+    if (a->choice_count != b->choice_count)
+        return false;
+    for (size_t i = 0; i < a->choice_count; ++i) {
+        if (strcmp(a->choices[i], b->choices[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool is_option_prefix(const Grammar* prefix, const Grammar* grammar) {
+    if (prefix->option_count > grammar->option_count)
+        return false;
+    for (size_t i = 0; i < prefix->option_count; ++i) {
+        if (!options_equal(&prefix->options[i], &grammar->options[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool shorts_equal(const Grammar* a, const Grammar* b) {
+    unsigned shorts[2][UCHAR_MAX + 1] = { { 0 } };
+    const Grammar* grammars[] = { a, b };
+    for (size_t k = 0; k < 2; ++k) {
+        for (size_t i = 0; i < grammars[k]->option_count; ++i) {
+            const Option* option = &grammars[k]->options[i];
+            if (option->short_name)
+                shorts[k][(unsigned char)option->short_name] = (unsigned)i * 2 + (option->arg ? 2 : 1);
+        }
+    }
+    return !memcmp(shorts[0], shorts[1], sizeof(shorts[0]));
+}
+
+static void find_owners(Module* module, const Grammar* const* grammars, size_t count) {
+    size_t* order = module->order;
+    for (size_t i = 0; i < count; ++i) {
+        size_t j = i;
+        for (; j > 0 && grammars[order[j - 1]]->option_count < grammars[i]->option_count; --j)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const Grammar* grammar = grammars[order[i]];
+        module->option_owners[order[i]] = grammar->prog;
+        for (size_t j = 0; j < i; ++j) {
+            const Grammar* other = grammars[order[j]];
+            if (module->option_owners[order[j]] == other->prog && is_option_prefix(grammar, other)) {
+                module->option_owners[order[i]] = other->prog;
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const Grammar* grammar = grammars[order[i]];
+        module->short_owners[order[i]] = grammar->prog;
+        for (size_t j = 0; j < i; ++j) {
+            const Grammar* other = grammars[order[j]];
+            if (module->short_owners[order[j]] == other->prog && shorts_equal(grammar, other)) {
+                module->short_owners[order[i]] = other->prog;
+                break;
+            }
+        }
+    }
+}
+
+// Appends the string to the blob if it is not there yet. The blob is emitted
+// as a sequence of literals, each with its own null terminator.
+static void intern_str(Module* module, StrBuf* blob, size_t* blob_size, const char* str) {
+    size_t len = strlen(str);
+    if (insert_in_str_table(&module->strings, str, (uint32_t)*blob_size)) {
+        print_c_str(blob, str, len + 1);
+        append_fmt(blob, "\n    ");
+        *blob_size += len + 1;
+    }
+}
+
+static uint32_t hash_prog(const char* name, uint32_t seed) {
+    // FNV-1a, with the seed mixed in the initial value
+    uint32_t hash = UINT32_C(0x811c9dc5) ^ seed;
+    for (; *name; ++name)
+        hash = (hash ^ (unsigned char)*name) * UINT32_C(0x01000193);
+    return hash;
+}
+
+// Finds a seed such that program names hash to distinct slots in a table of
+// 2^bits entries, starting with the smallest table. Slots are given by the high
+// bits of the hash, which depend on all the characters of the name.
+static uint32_t find_prog_hash(const Grammar* const* grammars, size_t count, int* bits) {
+    int slot_bits = 1;
+    while (((size_t)1 << slot_bits) < count)
+        slot_bits++;
+    for (;; slot_bits++) {
+        size_t size = (size_t)1 << slot_bits;
+        bool* is_used = malloc(sizeof(bool) * size);
+        for (uint32_t seed = 0; seed < 4096; ++seed) {
+            memset(is_used, 0, sizeof(bool) * size);
+            size_t i = 0;
+            for (; i < count; ++i) {
+                size_t slot = hash_prog(grammars[i]->prog, seed) >> (32 - slot_bits);
+                if (is_used[slot])
+                    break;
+                is_used[slot] = true;
+            }
+            if (i == count) {
+                free(is_used);
+                *bits = slot_bits;
+                return seed;
+            }
+        }
+        free(is_used);
+    }
+}
+
+static void emit_dispatch(StrBuf* buf, const Module* module, const Grammar* const* grammars, size_t count) {
+    append_fmt(buf, "enum {\n");
+    for (size_t i = 0; i < count; ++i) {
+        append_fmt(buf, "    ");
+        print_upper(buf, module->name);
+        append_char(buf, '_');
+        print_upper(buf, grammars[i]->prog);
+        append_fmt(buf, ",\n");
+    }
+    append_fmt(buf, "    ");
+    print_upper(buf, module->name);
+    append_fmt(buf, "_PROGRAM_COUNT\n};\n\n");
+
+    append_fmt(buf, "static const char* const %s_programs[] = {", module->name);
+    for (size_t i = 0; i < count; ++i) {
+        append_fmt(buf, "%s", i == 0 ? " " : ", ");
+        print_str(buf, module, grammars[i]->prog);
+    }
+    append_fmt(buf, " };\n\n");
+
+    int bits = 0;
+    uint32_t seed = find_prog_hash(grammars, count, &bits);
+    size_t slot_count = (size_t)1 << bits;
+    int* slots = malloc(sizeof(int) * slot_count);
+    for (size_t i = 0; i < slot_count; ++i)
+        slots[i] = -1;
+    for (size_t i = 0; i < count; ++i)
+        slots[hash_prog(grammars[i]->prog, seed) >> (32 - bits)] = (int)i;
+    append_fmt(buf,
+        "// Returns the program named by the last component of the given path (usually\n"
+        "// argv[0]), or -1 if there is none. Names are dispatched with a perfect hash.\n"
+        "static inline int find_%s_program(const char* path) {\n"
+        "    static const %s slots[%zu] = {",
+        module->name, count < SCHAR_MAX ? "signed char" : "int", slot_count);
+    for (size_t i = 0; i < slot_count; ++i)
+        append_fmt(buf, "%s%s%d", i == 0 ? "" : ",", i % 16 == 0 ? "\n        " : " ", slots[i]);
+    append_fmt(buf,
+        "\n    };\n"
+        "    const char* name = strrchr(path, '/');\n"
+        "    name = name ? name + 1 : path;\n"
+        "    unsigned long hash = 0x%08"PRIx32"UL;\n"
+        "    for (const char* c = name; *c; ++c)\n"
+        "        hash = ((hash ^ (unsigned char)*c) * 0x01000193UL) & 0xffffffffUL;\n"
+        "    int prog = slots[hash >> %d];\n"
+        "    return prog >= 0 && !strcmp(name, %s_programs[prog]) ? prog : -1;\n"
+        "}\n\n",
+        UINT32_C(0x811c9dc5) ^ seed, 32 - bits, module->name);
+    free(slots);
+}
+
+void emit_c_module(StrBuf* buf, const char* name, const Grammar* const* grammars, size_t count, const CodegenOptions* options) {
+    Module module = {
+        .name = name,
+        .strings = make_str_table(),
+        .order = malloc(sizeof(size_t) * count),
+        .option_owners = malloc(sizeof(const char*) * count),
+        .short_owners = malloc(sizeof(const char*) * count)
+    };
+    find_owners(&module, grammars, count);
+
+    // Strings are interned in order of appearance
+    StrBuf blob = make_str_buf();
+    size_t blob_size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const Grammar* grammar = grammars[i];
+        intern_str(&module, &blob, &blob_size, grammar->prog);
+        for (size_t j = 0; j < grammar->option_count; ++j) {
+            const Option* option = &grammar->options[j];
+            if (module.option_owners[i] != grammar->prog)
+                break;
+            if (option->long_name)
+                intern_str(&module, &blob, &blob_size, option->long_name);
+            for (size_t k = 0; option->arg && option->arg_type == ARG_TYPE_CHOICE && k < option->choice_count; ++k)
+                intern_str(&module, &blob, &blob_size, option->choices[k]);
+        }
+        for (size_t j = 0; j < grammar->positional_count; ++j) {
+            if (grammar->positionals[j].is_command)
+                intern_str(&module, &blob, &blob_size, grammar->positionals[j].name);
+        }
+    }
+
+    append_fmt(buf, "// Generated by docoptc. Do not edit.\n");
+    append_fmt(buf, "#ifndef ");
+    print_upper(buf, name);
+    append_fmt(buf, "_MODULE_H\n#define ");
+    print_upper(buf, name);
+    append_fmt(buf, "_MODULE_H\n\n");
+    append_fmt(buf, "%s\n", runtime_data);
+    size_t start = buf->size;
+
+    append_fmt(buf, "static const char %s_strings[] =\n    ", name);
+    append_str(buf, blob.data, blob.size);
+    append_fmt(buf, "\"\";\n\n");
+
+    size_t state_count = 0, function_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        module.current = module.order[i];
+        function_count += emit_program(buf, grammars[module.current], options, &module);
+        state_count += grammars[module.current]->node_count;
+    }
+    emit_dispatch(buf, &module, grammars, count);
+    if (options->stats) {
+        options->stats->code_size = buf->size - start;
+        options->stats->state_count = state_count;
+        options->stats->function_count = function_count;
+    }
+
+    append_fmt(buf, "#endif\n");
+    free_str_buf(&blob);
+    free_str_table(&module.strings);
+    free(module.order);
+    free(module.option_owners);
+    free(module.short_owners);
+}
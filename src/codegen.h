@@ -0,0 +1,64 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct Grammar Grammar;
+typedef struct Option  Option;
+typedef struct Profile Profile;
+typedef struct StrBuf  StrBuf;
+
+typedef enum {
+    TARGET_C,
+    TARGET_CPP,
+    TARGET_IMAGE,
+    TARGET_BASH
+} Target;
+
+// Generation profiles of the C target: tables interpreted by the runtime, with
+// the short option table omitted for size, or specialized matching code.
+typedef enum {
+    OPT_DEFAULT,
+    OPT_SIZE,
+    OPT_SPEED
+} OptLevel;
+
+typedef struct CodegenStats {
+    size_t code_size;
+    size_t state_count;
+    size_t function_count;
+} CodegenStats;
+
+typedef struct CodegenOptions {
+    Target target;
+    OptLevel opt_level;
+    bool response_files;
+    // The specification is embedded in a comment of a source file (see extract.h)
+    bool embedded;
+    // Large option sections are parsed on up to this many threads
+    size_t parse_threads;
+    // Only supported by the C target
+    bool instrument;
+    // Optional profile used to reorder the grammar
+    const Profile* profile;
+    // Optional, filled by the C target. The code size excludes the runtime.
+    CodegenStats* stats;
+} CodegenOptions;
+
+void emit_c_code(StrBuf*, const Grammar*, const CodegenOptions*);
+// Response files are not supported by the C++ target
+void emit_cpp_code(StrBuf*, const Grammar*, const CodegenOptions*);
+void emit_image(StrBuf*, const Grammar*, const CodegenOptions*);
+void emit_bash_completion(StrBuf*, const Grammar*, const CodegenOptions*);
+// Emits a single C module for several programs, which share their strings and
+// identical tables, along with a function that finds a program by name.
+void emit_c_module(StrBuf*, const char* name, const Grammar* const*, size_t count, const CodegenOptions*);
+
+// Helpers shared by the C and C++ backends
+void print_upper(StrBuf*, const char*);
+void print_c_str(StrBuf*, const char*, size_t);
+void print_doc(StrBuf*, const char* doc);
+void print_default_val(StrBuf*, const char* prog, const Option*);
+
+#endif
@@ -0,0 +1,495 @@
+#include "codegen.h"
+#include "grammar.h"
+#include "str_buf.h"
+#include "str_table.h"
+#include "mem_pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <ctype.h>
+
+// Bounds the work spent on building states, since sets of nodes can grow with
+// the number of optional elements in a row, so that the script is generated in
+// linear time. States that could not be expanded within the budget keep their
+// words but have no transitions, and are reported in the script.
+#define MIN_STEPS (64 * 1024)
+#define STEPS_PER_NODE 16
+
+// Word standing for an argument
+#define ARG_WORD "<>"
+
+static const char arg_word[] = ARG_WORD;
+
+// Completion is driven by a state machine, built by subset construction: each
+// state is the set of positional nodes that can match the next word, and states
+// with the same set are merged through a table. State 0 stands for the program
+// name. Each state lists the words of its nodes, and transitions are looked up
+// by state and word. Any word can be taken by an argument, so the transition on
+// a command also advances the arguments of the state.
+typedef struct CompletionState {
+    const char** words;
+    size_t word_count;
+    // Nodes grouped by word, each word ending at the matching offset
+    const uint32_t* nodes;
+    const size_t* word_ends;
+    size_t arg_word_index;
+} CompletionState;
+
+typedef struct Transition {
+    const char* key;
+    size_t state;
+} Transition;
+
+// Nodes to enter, or to leave once they have matched
+typedef struct WalkItem {
+    size_t node;
+    bool is_exit;
+} WalkItem;
+
+typedef struct CompletionWriter {
+    const Grammar* grammar;
+    MemPool mem_pool;
+    StrBuf key;
+    // States by their set of nodes
+    StrTable state_ids;
+    CompletionState* states;
+    size_t state_count, state_cap;
+    Transition* transitions;
+    size_t transition_count, transition_cap;
+    // Per node: its parent, and the last walk that entered or left it
+    size_t* parents;
+    size_t* entered;
+    size_t* left;
+    size_t walk;
+    // Per word, indexed by positional (or by positional count for arguments):
+    // the last state that used it, and its index in that state
+    size_t* word_states;
+    size_t* word_indices;
+    // Nodes reached by the current walk, and items left to visit
+    uint32_t* found;
+    size_t found_count;
+    WalkItem* items;
+    size_t item_count;
+    size_t step_count, max_steps;
+} CompletionWriter;
+
+static const char* get_word(const Grammar* grammar, const Node* node) {
+    return node->tag == NODE_COMMAND ? grammar->positionals[node->index].name : arg_word;
+}
+
+static size_t get_word_id(const Grammar* grammar, const Node* node) {
+    return node->tag == NODE_COMMAND ? node->index : grammar->positional_count;
+}
+
+static int compare_nodes(const void* first, const void* second) {
+    uint32_t first_node = *(const uint32_t*)first, second_node = *(const uint32_t*)second;
+    return first_node < second_node ? -1 : first_node > second_node;
+}
+
+// Adds a state for the nodes found by the last walk, unless it already exists
+static size_t find_state(CompletionWriter* writer) {
+    const Grammar* grammar = writer->grammar;
+    qsort(writer->found, writer->found_count, sizeof(uint32_t), compare_nodes);
+    writer->key.size = 0;
+    for (size_t i = 0; i < writer->found_count; ++i)
+        append_fmt(&writer->key, "%s%u", i == 0 ? "" : " ", writer->found[i]);
+    append_char(&writer->key, 0);
+    writer->step_count += writer->found_count;
+
+    uint32_t id;
+    if (find_in_str_table(&writer->state_ids, writer->key.data, &id))
+        return id;
+    char* key = mem_pool_alloc(&writer->mem_pool, writer->key.size, alignof(char));
+    memcpy(key, writer->key.data, writer->key.size);
+    id = (uint32_t)writer->state_count;
+    insert_in_str_table(&writer->state_ids, key, id);
+
+    // Words are listed in the order of their first node
+    size_t word_count = 0;
+    size_t* word_sizes = mem_pool_alloc(&writer->mem_pool, sizeof(size_t) * (writer->found_count + 1), alignof(size_t));
+    const char** words = mem_pool_alloc(&writer->mem_pool, sizeof(const char*) * (writer->found_count + 1), alignof(const char*));
+    size_t arg_word_index = SIZE_MAX;
+    for (size_t i = 0; i < writer->found_count; ++i) {
+        const Node* node = &grammar->nodes[writer->found[i]];
+        size_t word_id = get_word_id(grammar, node);
+        if (writer->word_states[word_id] != id) {
+            writer->word_states[word_id] = id;
+            writer->word_indices[word_id] = word_count;
+            words[word_count] = get_word(grammar, node);
+            word_sizes[word_count++] = 0;
+            if (node->tag == NODE_ARG)
+                arg_word_index = word_count - 1;
+        }
+        word_sizes[writer->word_indices[word_id]]++;
+    }
+    for (size_t i = 1; i < word_count; ++i)
+        word_sizes[i] += word_sizes[i - 1];
+    uint32_t* nodes = mem_pool_alloc(&writer->mem_pool, sizeof(uint32_t) * (writer->found_count + 1), alignof(uint32_t));
+    for (size_t i = writer->found_count; i-- > 0;) {
+        size_t word_id = get_word_id(grammar, &grammar->nodes[writer->found[i]]);
+        nodes[--word_sizes[writer->word_indices[word_id]]] = writer->found[i];
+    }
+    // Offsets now point to the beginning of each word, which is the end of the previous one
+    size_t* word_ends = mem_pool_alloc(&writer->mem_pool, sizeof(size_t) * (word_count + 1), alignof(size_t));
+    for (size_t i = 0; i < word_count; ++i)
+        word_ends[i] = i + 1 < word_count ? word_sizes[i + 1] : writer->found_count;
+
+    if (writer->state_count >= writer->state_cap) {
+        writer->state_cap = writer->state_cap ? writer->state_cap * 2 : 16;
+        writer->states = realloc(writer->states, sizeof(CompletionState) * writer->state_cap);
+    }
+    writer->states[writer->state_count] = (CompletionState) {
+        .words = words,
+        .word_count = word_count,
+        .nodes = nodes,
+        .word_ends = word_ends,
+        .arg_word_index = arg_word_index
+    };
+    return writer->state_count++;
+}
+
+static void push_item(CompletionWriter* writer, size_t node, bool is_exit) {
+    size_t* walks = is_exit ? writer->left : writer->entered;
+    if (walks[node] == writer->walk)
+        return;
+    walks[node] = writer->walk;
+    writer->items[writer->item_count++] = (WalkItem) { .node = node, .is_exit = is_exit };
+}
+
+// Finds the positional nodes that can match after entering or leaving the
+// pushed nodes. Options do not match any word. Groups in brackets are either
+// fully present or absent, and repeated elements can match again once left.
+static void walk_nodes(CompletionWriter* writer) {
+    const Grammar* grammar = writer->grammar;
+    while (writer->item_count > 0) {
+        WalkItem item = writer->items[--writer->item_count];
+        size_t index = item.node;
+        const Node* node = &grammar->nodes[index];
+        writer->step_count++;
+        if (item.is_exit) {
+            size_t parent = writer->parents[index];
+            if (parent == SIZE_MAX)
+                continue;
+            const Node* parent_node = &grammar->nodes[parent];
+            size_t next = index + node->size;
+            bool is_seq = parent_node->tag == NODE_SEQ || parent_node->tag == NODE_OPTIONAL;
+            if (is_seq && next < parent + parent_node->size)
+                push_item(writer, next, false);
+            else
+                push_item(writer, parent, true);
+            if (parent_node->tag == NODE_REPEAT)
+                push_item(writer, index, false);
+            continue;
+        }
+        switch (node->tag) {
+            case NODE_COMMAND:
+            case NODE_ARG:
+                writer->found[writer->found_count++] = index;
+                break;
+            case NODE_OPTION:
+            case NODE_ANY_OPTIONS:
+                push_item(writer, index, true);
+                break;
+            case NODE_OPTIONAL:
+            case NODE_SEQ:
+                if (node->tag == NODE_OPTIONAL || node->size == 1)
+                    push_item(writer, index, true);
+                if (node->size > 1)
+                    push_item(writer, index + 1, false);
+                break;
+            case NODE_OR:
+                for (size_t child = index + 1; child < index + node->size; child += grammar->nodes[child].size)
+                    push_item(writer, child, false);
+                break;
+            case NODE_REPEAT:
+                push_item(writer, index + 1, false);
+                break;
+            default:
+                assert(false && "invalid node tag");
+                break;
+        }
+    }
+}
+
+static void leave_word_nodes(CompletionWriter* writer, const CompletionState* state, size_t word_index) {
+    size_t begin = word_index > 0 ? state->word_ends[word_index - 1] : 0;
+    for (size_t i = begin; i < state->word_ends[word_index]; ++i)
+        push_item(writer, state->nodes[i], true);
+}
+
+static void add_transition(CompletionWriter* writer, size_t state, const char* word, size_t next) {
+    writer->key.size = 0;
+    append_fmt(&writer->key, "%zu %s", state, word);
+    append_char(&writer->key, 0);
+    char* key = mem_pool_alloc(&writer->mem_pool, writer->key.size, alignof(char));
+    memcpy(key, writer->key.data, writer->key.size);
+    if (writer->transition_count >= writer->transition_cap) {
+        writer->transition_cap = writer->transition_cap ? writer->transition_cap * 2 : 16;
+        writer->transitions = realloc(writer->transitions, sizeof(Transition) * writer->transition_cap);
+    }
+    writer->transitions[writer->transition_count++] = (Transition) { .key = key, .state = next };
+}
+
+// Returns false if the budget ran out before all transitions were added
+static bool expand_state(CompletionWriter* writer, size_t index) {
+    // States are reallocated as new ones are found, but their contents are not
+    CompletionState state = writer->states[index];
+    for (size_t i = 0; i < state.word_count; ++i) {
+        if (writer->step_count >= writer->max_steps)
+            return false;
+        writer->walk++;
+        writer->found_count = 0;
+        leave_word_nodes(writer, &state, i);
+        if (state.arg_word_index != SIZE_MAX && state.arg_word_index != i)
+            leave_word_nodes(writer, &state, state.arg_word_index);
+        walk_nodes(writer);
+        add_transition(writer, index, state.words[i], find_state(writer));
+    }
+    return true;
+}
+
+// Returns the number of states that could not be expanded
+static size_t build_states(CompletionWriter* writer) {
+    const Grammar* grammar = writer->grammar;
+    size_t node_count = grammar->node_count;
+    writer->parents = malloc(sizeof(size_t) * (node_count + 1));
+    writer->entered = calloc(node_count + 1, sizeof(size_t));
+    writer->left = calloc(node_count + 1, sizeof(size_t));
+    writer->word_states = malloc(sizeof(size_t) * (grammar->positional_count + 1));
+    writer->word_indices = malloc(sizeof(size_t) * (grammar->positional_count + 1));
+    writer->found = malloc(sizeof(uint32_t) * (node_count + 1));
+    writer->items = malloc(sizeof(WalkItem) * (2 * node_count + 1));
+    writer->max_steps = MIN_STEPS + STEPS_PER_NODE * node_count;
+    for (size_t i = 0; i < node_count; ++i)
+        writer->parents[i] = SIZE_MAX;
+    for (size_t i = 0; i < node_count; ++i) {
+        for (size_t child = i + 1; child < i + grammar->nodes[i].size; child += grammar->nodes[child].size)
+            writer->parents[child] = i;
+    }
+    for (size_t i = 0; i <= grammar->positional_count; ++i)
+        writer->word_states[i] = SIZE_MAX;
+
+    writer->walk = 1;
+    for (size_t i = 0; i < grammar->usage_count; ++i)
+        push_item(writer, grammar->usages[i], false);
+    walk_nodes(writer);
+    find_state(writer);
+    for (size_t i = 0; i < writer->state_count; ++i) {
+        if (!expand_state(writer, i))
+            return writer->state_count - i;
+    }
+    return 0;
+}
+
+static void print_ident(StrBuf* buf, const char* str) {
+    for (; *str; ++str)
+        append_char(buf, isalnum((unsigned char)*str) ? *str : '_');
+}
+
+// Strings are single-quoted, so that the shell does not expand them
+static void print_shell_str(StrBuf* buf, const char* str) {
+    append_char(buf, '\'');
+    for (; *str; ++str) {
+        if (*str == '\'')
+            append_fmt(buf, "'\\''");
+        else
+            append_char(buf, *str);
+    }
+    append_char(buf, '\'');
+}
+
+static void emit_states(StrBuf* buf, CompletionWriter* writer) {
+    const Grammar* grammar = writer->grammar;
+    size_t truncated_count = build_states(writer);
+    if (truncated_count > 0) {
+        append_fmt(buf,
+            "# The grammar is too large for exact completion: %zu of %zu states were not\n"
+            "# expanded, and complete the same words again after any word.\n\n",
+            truncated_count, writer->state_count);
+    }
+    append_fmt(buf,
+        "# Words that can follow each state, where '" ARG_WORD "' stands for an argument.\n"
+        "# State 0 is the program name, and others are reached by a state and a word.\n"
+        "declare -a _");
+    print_ident(buf, grammar->prog);
+    append_fmt(buf, "_words=(\n");
+    for (size_t i = 0; i < writer->state_count; ++i) {
+        const CompletionState* state = &writer->states[i];
+        if (state->word_count == 0)
+            continue;
+        StrBuf words = make_str_buf();
+        for (size_t j = 0; j < state->word_count; ++j)
+            append_fmt(&words, "%s%s", j == 0 ? "" : " ", state->words[j]);
+        append_char(&words, 0);
+        append_fmt(buf, "    [%zu]=", i);
+        print_shell_str(buf, words.data);
+        append_fmt(buf, "\n");
+        free_str_buf(&words);
+    }
+    append_fmt(buf, ")\ndeclare -A _");
+    print_ident(buf, grammar->prog);
+    append_fmt(buf, "_next=(\n");
+    for (size_t i = 0; i < writer->transition_count; ++i) {
+        append_fmt(buf, "    [");
+        print_shell_str(buf, writer->transitions[i].key);
+        append_fmt(buf, "]=%zu\n", writer->transitions[i].state);
+    }
+    append_fmt(buf, ")\n\n");
+}
+
+static void print_option_names(StrBuf* buf, const Option* option, bool* is_first) {
+    if (option->short_name) {
+        append_fmt(buf, "%s-%c", *is_first ? "" : " ", option->short_name);
+        *is_first = false;
+    }
+    if (option->long_name) {
+        append_fmt(buf, "%s--%s", *is_first ? "" : " ", option->long_name);
+        *is_first = false;
+    }
+}
+
+static void emit_options(StrBuf* buf, const Grammar* grammar) {
+    const char* prog = grammar->prog;
+    StrBuf names = make_str_buf(), valued = make_str_buf();
+    bool is_first_name = true, is_first_valued = true;
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        print_option_names(&names, option, &is_first_name);
+        if (option->arg)
+            print_option_names(&valued, option, &is_first_valued);
+    }
+    append_char(&names, 0);
+    append_char(&valued, 0);
+
+    append_fmt(buf, "# Options, and options that take an argument\n_");
+    print_ident(buf, prog);
+    append_fmt(buf, "_options=");
+    print_shell_str(buf, names.data);
+    append_fmt(buf, "\n_");
+    print_ident(buf, prog);
+    append_fmt(buf, "_valued=' %s '\n\n", valued.data);
+    free_str_buf(&names);
+    free_str_buf(&valued);
+
+    append_fmt(buf, "declare -A _");
+    print_ident(buf, prog);
+    append_fmt(buf, "_choices=(\n");
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        if (!option->arg || option->arg_type != ARG_TYPE_CHOICE)
+            continue;
+        StrBuf choices = make_str_buf();
+        for (size_t j = 0; j < option->choice_count; ++j)
+            append_fmt(&choices, "%s%s", j == 0 ? "" : " ", option->choices[j]);
+        append_char(&choices, 0);
+        if (option->short_name)
+            append_fmt(buf, "    ['-%c']=", option->short_name);
+        if (option->short_name)
+            print_shell_str(buf, choices.data);
+        if (option->short_name && option->long_name)
+            append_fmt(buf, "\n");
+        if (option->long_name) {
+            append_fmt(buf, "    ['--%s']=", option->long_name);
+            print_shell_str(buf, choices.data);
+        }
+        append_fmt(buf, "\n");
+        free_str_buf(&choices);
+    }
+    append_fmt(buf, ")\n\n");
+}
+
+static void emit_function(StrBuf* buf, const Grammar* grammar) {
+    StrBuf ident = make_str_buf();
+    print_ident(&ident, grammar->prog);
+    append_char(&ident, 0);
+    const char* name = ident.data;
+    // Words are split on spaces only, since bash also splits them on '='
+    append_fmt(buf,
+        "_%s_complete() {\n"
+        "    local line=${COMP_LINE:0:COMP_POINT} cur=\"\" state word next i\n"
+        "    local -a words\n"
+        "    read -ra words <<< \"$line\"\n"
+        "    [[ $line == *[[:space:]] ]] || { cur=${words[-1]}; unset 'words[-1]'; }\n"
+        "    local prev=${words[-1]}\n"
+        "    COMPREPLY=()\n"
+        "    if [[ ${#words[@]} -gt 1 && $_%s_valued == *\" $prev \"* ]]; then\n"
+        "        if [[ -v _%s_choices[$prev] ]]; then\n"
+        "            COMPREPLY=($(compgen -W \"${_%s_choices[$prev]}\" -- \"$cur\"))\n"
+        "        else\n"
+        "            COMPREPLY=($(compgen -f -- \"$cur\"))\n"
+        "        fi\n"
+        "        return\n"
+        "    fi\n"
+        "    if [[ $cur == -*=* ]]; then\n"
+        "        [[ -v _%s_choices[${cur%%%%=*}] ]] &&\n"
+        "            COMPREPLY=($(compgen -W \"${_%s_choices[${cur%%%%=*}]}\" -- \"${cur#*=}\"))\n"
+        "        return\n"
+        "    fi\n"
+        "    if [[ $cur == -* ]]; then\n"
+        "        COMPREPLY=($(compgen -W \"$_%s_options\" -- \"$cur\"))\n"
+        "        return\n"
+        "    fi\n"
+        "\n"
+        "    # Options are skipped, along with their argument, and unknown words do not change the state\n"
+        "    state=0\n"
+        "    for ((i = 1; i < ${#words[@]}; i++)); do\n"
+        "        word=${words[i]}\n"
+        "        if [[ $word == -* ]]; then\n"
+        "            [[ $_%s_valued == *\" $word \"* ]] && ((i++))\n"
+        "            continue\n"
+        "        fi\n"
+        "        next=\" ${_%s_words[state]} \"\n"
+        "        if [[ $next != *\" $word \"* ]]; then\n"
+        "            [[ $next == *\" " ARG_WORD " \"* ]] || continue\n"
+        "            word='" ARG_WORD "'\n"
+        "        fi\n"
+        "        [[ -v _%s_next[\"$state $word\"] ]] && state=${_%s_next[\"$state $word\"]}\n"
+        "    done\n"
+        "\n"
+        "    next=\" ${_%s_words[state]} \"\n"
+        "    COMPREPLY=($(compgen -W \"${next//'" ARG_WORD "'/}\" -- \"$cur\"))\n"
+        "    [[ $next == *\" " ARG_WORD " \"* ]] && COMPREPLY+=($(compgen -f -- \"$cur\"))\n"
+        "}\n\n",
+        name, name, name, name, name, name, name, name, name, name, name, name);
+    free_str_buf(&ident);
+}
+
+void emit_bash_completion(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options) {
+    (void)options;
+    append_fmt(buf,
+        "# Generated by docoptc. Do not edit.\n"
+        "# Bash completion for '%s', which can also be used by zsh after running\n"
+        "# 'autoload -U bashcompinit && bashcompinit'.\n\n",
+        grammar->prog);
+
+    CompletionWriter writer = {
+        .grammar = grammar,
+        .mem_pool = new_mem_pool(),
+        .key = make_str_buf(),
+        .state_ids = make_str_table()
+    };
+    emit_states(buf, &writer);
+    emit_options(buf, grammar);
+    emit_function(buf, grammar);
+
+    append_fmt(buf, "complete -o filenames -F _");
+    print_ident(buf, grammar->prog);
+    append_fmt(buf, "_complete ");
+    print_shell_str(buf, grammar->prog);
+    append_fmt(buf, "\n");
+
+    free(writer.states);
+    free(writer.transitions);
+    free(writer.parents);
+    free(writer.entered);
+    free(writer.left);
+    free(writer.word_states);
+    free(writer.word_indices);
+    free(writer.found);
+    free(writer.items);
+    free_str_table(&writer.state_ids);
+    free_str_buf(&writer.key);
+    free_mem_pool(&writer.mem_pool);
+}
@@ -0,0 +1,227 @@
+#include "codegen.h"
+#include "grammar.h"
+#include "str_buf.h"
+
+#include <assert.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+// Contents of 'runtime.hpp', embedded by the build system
+extern const char runtime_cpp_data[];
+
+// Choices are scoped in an enumeration, and only need a prefix when they would
+// not be valid identifiers otherwise.
+static void print_choice_name(StrBuf* buf, const Option* option, size_t choice) {
+    if (isdigit((unsigned char)option->choices[choice][0])) {
+        print_upper(buf, option->field + 4);
+        append_char(buf, '_');
+    }
+    print_upper(buf, option->choices[choice]);
+}
+
+static const char* get_option_kind(const Option* option) {
+    if (!option->arg)
+        return option->is_repeated ? "docopt::Kind::count" : "docopt::Kind::flag";
+    switch (option->arg_type) {
+        case ARG_TYPE_INT:    return "docopt::Kind::int_value";
+        case ARG_TYPE_FLOAT:  return "docopt::Kind::float_value";
+        case ARG_TYPE_BOOL:   return "docopt::Kind::bool_value";
+        case ARG_TYPE_CHOICE: return "docopt::Kind::choice";
+        default:              return "docopt::Kind::string";
+    }
+}
+
+static void print_option_type(StrBuf* buf, const char* prog, const Option* option) {
+    if (!option->arg) {
+        append_fmt(buf, "%s", option->is_repeated ? "unsigned" : "bool");
+        return;
+    }
+    switch (option->arg_type) {
+        case ARG_TYPE_INT:    append_fmt(buf, "long long"); break;
+        case ARG_TYPE_FLOAT:  append_fmt(buf, "double");    break;
+        case ARG_TYPE_BOOL:   append_fmt(buf, "bool");      break;
+        case ARG_TYPE_CHOICE: append_fmt(buf, "%s_%s", prog, option->field + 4); break;
+        default:              append_fmt(buf, "std::string_view"); break;
+    }
+}
+
+static const char* get_positional_kind(const Positional* positional) {
+    if (positional->is_command)
+        return positional->is_repeated ? "docopt::PositionalKind::command_count" : "docopt::PositionalKind::command";
+    return positional->is_repeated ? "docopt::PositionalKind::arg_list" : "docopt::PositionalKind::arg";
+}
+
+static const char* get_positional_type(const Positional* positional) {
+    if (positional->is_command)
+        return positional->is_repeated ? "unsigned " : "bool ";
+    return positional->is_repeated ? "std::span<const std::string_view> " : "std::string_view ";
+}
+
+static void emit_choices(StrBuf* buf, const Grammar* grammar) {
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        if (!option->arg || option->arg_type != ARG_TYPE_CHOICE)
+            continue;
+        append_fmt(buf, "enum class %s_%s : int {\n", grammar->prog, option->field + 4);
+        for (size_t j = 0; j < option->choice_count; ++j) {
+            append_fmt(buf, "    ");
+            print_choice_name(buf, option, j);
+            append_fmt(buf, "%s\n", j + 1 < option->choice_count ? "," : "");
+        }
+        append_fmt(buf, "};\n\n");
+    }
+}
+
+static void emit_struct(StrBuf* buf, const Grammar* grammar) {
+    append_fmt(buf, "struct %s_args {\n", grammar->prog);
+    for (size_t i = 0; i < grammar->positional_count; ++i) {
+        const Positional* positional = &grammar->positionals[i];
+        append_fmt(buf, "    %s%s%s;\n", get_positional_type(positional), positional->field,
+            positional->is_command ? " = {}" : "");
+    }
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        append_fmt(buf, "    ");
+        print_option_type(buf, grammar->prog, option);
+        append_fmt(buf, " %s", option->field);
+        if (option->arg && option->default_val && option->arg_type == ARG_TYPE_CHOICE) {
+            for (size_t j = 0; j < option->choice_count; ++j) {
+                if (strcmp(option->choices[j], option->default_val))
+                    continue;
+                append_fmt(buf, " = %s_%s::", grammar->prog, option->field + 4);
+                print_choice_name(buf, option, j);
+            }
+        } else if (option->arg && option->default_val) {
+            append_fmt(buf, " = ");
+            print_default_val(buf, grammar->prog, option);
+        } else if (!option->arg || option->arg_type != ARG_TYPE_STRING)
+            append_fmt(buf, " = {}");
+        append_fmt(buf, ";\n");
+    }
+    append_fmt(buf, "};\n\n");
+}
+
+static size_t emit_node(StrBuf* buf, const Grammar* grammar, size_t index) {
+    const Node* node = &grammar->nodes[index];
+    switch (node->tag) {
+        case NODE_COMMAND: append_fmt(buf, "docopt::Command<%"PRIu32">", node->index); return index + 1;
+        case NODE_ARG:     append_fmt(buf, "docopt::Arg<%"PRIu32">", node->index);     return index + 1;
+        case NODE_OPTION:  append_fmt(buf, "docopt::Opt<%"PRIu32">", node->index);     return index + 1;
+        case NODE_ANY_OPTIONS: append_fmt(buf, "docopt::AnyOptions");                 return index + 1;
+        case NODE_SEQ:      append_fmt(buf, "docopt::Seq<");      break;
+        case NODE_OPTIONAL: append_fmt(buf, "docopt::Optional<"); break;
+        case NODE_OR:       append_fmt(buf, "docopt::Or<");       break;
+        case NODE_REPEAT:   append_fmt(buf, "docopt::Repeat<");   break;
+        default:
+            assert(false && "invalid node tag");
+            break;
+    }
+    size_t end = index + node->size;
+    for (size_t child = index + 1; child < end;) {
+        if (child != index + 1)
+            append_fmt(buf, ", ");
+        child = emit_node(buf, grammar, child);
+    }
+    append_char(buf, '>');
+    return end;
+}
+
+static void emit_spec(StrBuf* buf, const Grammar* grammar) {
+    const char* prog = grammar->prog;
+    append_fmt(buf, "struct %s_spec {\n", prog);
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        if (!option->arg || option->arg_type != ARG_TYPE_CHOICE)
+            continue;
+        append_fmt(buf, "    static constexpr std::array<std::string_view, %zu> %s_choices = {", option->choice_count, option->field);
+        for (size_t j = 0; j < option->choice_count; ++j) {
+            append_fmt(buf, "%s", j == 0 ? " " : ", ");
+            print_c_str(buf, option->choices[j], strlen(option->choices[j]));
+        }
+        append_fmt(buf, " };\n");
+    }
+
+    append_fmt(buf, "    static constexpr std::array<docopt::Option, %zu> options = {", grammar->option_count);
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        append_fmt(buf, "%s\n        { ", i == 0 ? "{" : ",");
+        if (option->long_name)
+            print_c_str(buf, option->long_name, strlen(option->long_name));
+        else
+            append_fmt(buf, "{}");
+        if (option->short_name)
+            append_fmt(buf, ", '%s%c'", option->short_name == '\\' || option->short_name == '\'' ? "\\" : "", option->short_name);
+        else
+            append_fmt(buf, ", 0");
+        append_fmt(buf, ", %s, %s, ", get_option_kind(option), option->is_in_usage ? "true" : "false");
+        if (option->arg && option->arg_type == ARG_TYPE_CHOICE)
+            append_fmt(buf, "%s_choices }", option->field);
+        else
+            append_fmt(buf, "{} }");
+    }
+    append_fmt(buf, grammar->option_count > 0 ? "\n    }};\n" : "};\n");
+
+    append_fmt(buf, "    static constexpr std::array<docopt::Positional, %zu> positionals = {", grammar->positional_count);
+    for (size_t i = 0; i < grammar->positional_count; ++i) {
+        const Positional* positional = &grammar->positionals[i];
+        append_fmt(buf, "%s\n        { ", i == 0 ? "{" : ",");
+        if (positional->is_command)
+            print_c_str(buf, positional->name, strlen(positional->name));
+        else
+            append_fmt(buf, "{}");
+        append_fmt(buf, ", %s }", get_positional_kind(positional));
+    }
+    append_fmt(buf, grammar->positional_count > 0 ? "\n    }};\n" : "};\n");
+
+    // Fields are bound through member pointers, so that values are stored directly
+    append_fmt(buf, "    using option_fields = docopt::Fields<");
+    for (size_t i = 0; i < grammar->option_count; ++i)
+        append_fmt(buf, "%s\n        &%s_args::%s", i == 0 ? "" : ",", prog, grammar->options[i].field);
+    append_fmt(buf, ">;\n");
+    append_fmt(buf, "    using positional_fields = docopt::Fields<");
+    for (size_t i = 0; i < grammar->positional_count; ++i)
+        append_fmt(buf, "%s\n        &%s_args::%s", i == 0 ? "" : ",", prog, grammar->positionals[i].field);
+    append_fmt(buf, ">;\n");
+
+    append_fmt(buf, "    using usages = docopt::Usages<");
+    for (size_t i = 0; i < grammar->usage_count; ++i) {
+        append_fmt(buf, "%s\n        ", i == 0 ? "" : ",");
+        emit_node(buf, grammar, grammar->usages[i]);
+    }
+    append_fmt(buf, ">;\n};\n\n");
+}
+
+static void emit_entry_points(StrBuf* buf, const Grammar* grammar) {
+    const char* prog = grammar->prog;
+    append_fmt(buf,
+        "// Parses the given arguments, which do not include the program name. The\n"
+        "// result refers to the argument strings and to the token array.\n"
+        "inline bool parse_%s_args(%s_args& args, std::span<std::string_view> tokens, docopt::Error& error) {\n"
+        "    args = %s_args{};\n"
+        "    return docopt::parse<%s_spec>(args, tokens, error);\n"
+        "}\n\n",
+        prog, prog, prog, prog);
+}
+
+void emit_cpp_code(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options) {
+    assert(!options->response_files);
+    (void)options;
+    append_fmt(buf, "// Generated by docoptc. Do not edit.\n");
+    append_fmt(buf, "#ifndef ");
+    print_upper(buf, grammar->prog);
+    append_fmt(buf, "_ARGS_HPP\n#define ");
+    print_upper(buf, grammar->prog);
+    append_fmt(buf, "_ARGS_HPP\n\n");
+    append_fmt(buf, "%s\n", runtime_cpp_data);
+
+    emit_choices(buf, grammar);
+    emit_struct(buf, grammar);
+    append_fmt(buf, "inline constexpr std::string_view %s_doc =", grammar->prog);
+    print_doc(buf, grammar->doc);
+    append_fmt(buf, ";\n\n");
+    emit_spec(buf, grammar);
+    emit_entry_points(buf, grammar);
+
+    append_fmt(buf, "#endif\n");
+}
@@ -0,0 +1,151 @@
+#include "docoptc.h"
+#include "lexer.h"
+#include "parser.h"
+#include "syntax.h"
+#include "grammar.h"
+#include "mem_pool.h"
+#include "profile.h"
+#include "extract.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+// Parses and checks the specification, leaving the positions of diagnostics
+// relative to the decoded literals, if any
+static Syntax* parse_source(
+    MemPool* mem_pool,
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions* options,
+    EmbeddedSpec* spec,
+    Log* log)
+{
+    *spec = (EmbeddedSpec) {
+        .data = data,
+        .range = {
+            .file_name = file_name,
+            .begin = { .row = 1, .col = 1, .bytes = 0 },
+            .end = { .bytes = size }
+        }
+    };
+    if (options->embedded && !find_embedded_spec(mem_pool, file_name, data, size, spec, log))
+        return NULL;
+
+    Lexer lexer = make_range_lexer(spec->data, &spec->range);
+    Parser parser = make_parser(mem_pool, &lexer, log);
+    parser.thread_count = options->parse_threads;
+    Syntax* syntax = parse(&parser);
+    if (syntax->tag == SYNTAX_ROOT && !is_log_full(log))
+        check_syntax(syntax, log);
+    return syntax;
+}
+
+Syntax* parse_spec(
+    MemPool* mem_pool,
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions* options,
+    Log* log)
+{
+    size_t error_count = log->error_count;
+    size_t diag_count = log->count;
+    EmbeddedSpec spec;
+    Syntax* syntax = parse_source(mem_pool, file_name, data, size, options, &spec, log);
+    if (syntax)
+        map_embedded_diags(&spec, data, log, diag_count);
+    return log->error_count == error_count ? syntax : NULL;
+}
+
+static Grammar* build_spec(
+    MemPool* mem_pool,
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions* options,
+    Log* log)
+{
+    size_t error_count = log->error_count;
+    size_t diag_count = log->count;
+    EmbeddedSpec spec;
+    Syntax* syntax = parse_source(mem_pool, file_name, data, size, options, &spec, log);
+    if (!syntax)
+        return NULL;
+
+    Grammar* grammar = NULL;
+    if (log->error_count == error_count) {
+        size_t doc_size = spec.range.end.bytes - spec.range.begin.bytes;
+        char* doc = mem_pool_alloc(mem_pool, doc_size + 1, alignof(char));
+        memcpy(doc, spec.data + spec.range.begin.bytes, doc_size);
+        doc[doc_size] = 0;
+        grammar = build_grammar(mem_pool, syntax, doc, log);
+    }
+    map_embedded_diags(&spec, data, log, diag_count);
+    return log->error_count == error_count ? grammar : NULL;
+}
+
+bool compile_spec(
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions* options,
+    StrBuf* output,
+    Log* log)
+{
+    MemPool mem_pool = new_mem_pool();
+    bool ok = compile_spec_in_pool(&mem_pool, file_name, data, size, options, output, log);
+    free_mem_pool(&mem_pool);
+    return ok;
+}
+
+bool compile_spec_in_pool(
+    MemPool* mem_pool,
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions* options,
+    StrBuf* output,
+    Log* log)
+{
+    reset_mem_pool(mem_pool);
+    Grammar* grammar = build_spec(mem_pool, file_name, data, size, options, log);
+    bool ok = grammar && (!options->profile || apply_profile(grammar, options->profile, log));
+    if (ok && options->target == TARGET_IMAGE)
+        emit_image(output, grammar, options);
+    else if (ok && options->target == TARGET_BASH)
+        emit_bash_completion(output, grammar, options);
+    else if (ok && options->target == TARGET_CPP)
+        emit_cpp_code(output, grammar, options);
+    else if (ok)
+        emit_c_code(output, grammar, options);
+    return ok;
+}
+
+bool compile_module(
+    const char* name,
+    const SpecSource* specs, size_t spec_count,
+    const CodegenOptions* options,
+    StrBuf* output,
+    Log* log)
+{
+    assert(options->target == TARGET_C && !options->profile && !options->instrument);
+    MemPool mem_pool = new_mem_pool();
+    const Grammar** grammars = malloc(sizeof(Grammar*) * spec_count);
+    bool ok = true;
+    for (size_t i = 0; i < spec_count; ++i) {
+        const SpecSource* spec = &specs[i];
+        grammars[i] = build_spec(&mem_pool, spec->file_name, spec->data, spec->size, options, log);
+        ok &= grammars[i] != NULL;
+        for (size_t j = 0; grammars[i] && j < i; ++j) {
+            if (grammars[j] && !strcmp(grammars[i]->prog, grammars[j]->prog)) {
+                SourcePos pos = { .row = 1, .col = 1 };
+                error_at(log, &(SourceRange) { .file_name = spec->file_name, .begin = pos, .end = pos },
+                    "program '%s' is already defined in '%s'", grammars[i]->prog, specs[j].file_name);
+                ok = false;
+            }
+        }
+    }
+    if (ok)
+        emit_c_module(output, name, grammars, spec_count, options);
+    free(grammars);
+    free_mem_pool(&mem_pool);
+    return ok;
+}
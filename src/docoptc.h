@@ -0,0 +1,64 @@
+#ifndef DOCOPTC_H
+#define DOCOPTC_H
+
+// Entry point of the docoptc library: compiles specifications held in memory,
+// without touching the file system or printing anything.
+
+#include "codegen.h"
+#include "str_buf.h"
+#include "log.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Compiles the specification in the given buffer (or embedded in it, if
+// `embedded` is set), which does not need to be null-terminated, and appends
+// the generated code (or grammar image, depending on the target) to the output
+// buffer.
+// Diagnostics are recorded in the log, with ranges referring to `file_name`.
+// Returns true on success.
+bool compile_spec(
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions*,
+    StrBuf* output,
+    Log* log);
+
+typedef struct MemPool MemPool;
+typedef struct Syntax  Syntax;
+
+// Parses and checks the specification as compile_spec does, without lowering
+// it. Returns its syntax tree, allocated from the pool, or NULL on error.
+Syntax* parse_spec(
+    MemPool*,
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions*,
+    Log* log);
+
+// Same as compile_spec, but allocates from the given pool after resetting it,
+// so that memory is reused when specifications are compiled repeatedly.
+bool compile_spec_in_pool(
+    MemPool*,
+    const char* file_name,
+    const char* data, size_t size,
+    const CodegenOptions*,
+    StrBuf* output,
+    Log* log);
+
+typedef struct SpecSource {
+    const char* file_name;
+    const char* data;
+    size_t size;
+} SpecSource;
+
+// Compiles several specifications, with distinct program names, into a single
+// C module named `name`. Only the C target is supported, without profiles.
+bool compile_module(
+    const char* name,
+    const SpecSource* specs, size_t spec_count,
+    const CodegenOptions*,
+    StrBuf* output,
+    Log* log);
+
+#endif
@@ -0,0 +1,294 @@
+#include "extract.h"
+#include "log.h"
+#include "mem_pool.h"
+
+#include <string.h>
+#include <ctype.h>
+#include <stdalign.h>
+
+// Source files can be large, and the search relies on memchr(), which is
+// vectorized by the C library, to skip to candidate positions.
+static const char* find_str(const char* begin, const char* end, const char* str, size_t len) {
+    while ((size_t)(end - begin) >= len) {
+        begin = memchr(begin, str[0], end - begin - len + 1);
+        if (!begin)
+            return NULL;
+        if (!memcmp(begin, str, len))
+            return begin;
+        begin++;
+    }
+    return NULL;
+}
+
+static uint32_t count_lines(const char* begin, const char* end) {
+    uint32_t count = 0;
+    while ((begin = memchr(begin, '\n', end - begin))) {
+        begin++;
+        count++;
+    }
+    return count;
+}
+
+static const char* find_line_begin(const char* data, const char* ptr) {
+    while (ptr != data && ptr[-1] != '\n')
+        ptr--;
+    return ptr;
+}
+
+static SourcePos get_pos(const char* data, const char* ptr) {
+    return (SourcePos) {
+        .row = count_lines(data, ptr) + 1,
+        .col = ptr - find_line_begin(data, ptr) + 1,
+        .bytes = ptr - data
+    };
+}
+
+static void error_at_ptr(Log* log, const char* file_name, const char* data, const char* ptr, const char* msg) {
+    SourcePos pos = get_pos(data, ptr);
+    error_at(log, &(SourceRange) { .file_name = file_name, .begin = pos, .end = pos }, "%s", msg);
+}
+
+// String literals are decoded twice: once to check them and compute the size
+// of the result, and once to fill the buffers.
+typedef struct Decoder {
+    const char* file_name;
+    const char* data;
+    const char* end;
+    char* chars;
+    size_t* offsets;
+    size_t size;
+    Log* log;
+} Decoder;
+
+static void push_char(Decoder* decoder, char c, const char* src) {
+    if (decoder->chars) {
+        decoder->chars[decoder->size] = c;
+        decoder->offsets[decoder->size] = src - decoder->data;
+    }
+    decoder->size++;
+}
+
+static void push_code_point(Decoder* decoder, uint32_t c, const char* src) {
+    if (c < 0x80) {
+        push_char(decoder, c, src);
+    } else if (c < 0x800) {
+        push_char(decoder, 0xC0 | (c >> 6), src);
+        push_char(decoder, 0x80 | (c & 0x3F), src);
+    } else if (c < 0x10000) {
+        push_char(decoder, 0xE0 | (c >> 12), src);
+        push_char(decoder, 0x80 | ((c >> 6) & 0x3F), src);
+        push_char(decoder, 0x80 | (c & 0x3F), src);
+    } else {
+        push_char(decoder, 0xF0 | (c >> 18), src);
+        push_char(decoder, 0x80 | ((c >> 12) & 0x3F), src);
+        push_char(decoder, 0x80 | ((c >> 6) & 0x3F), src);
+        push_char(decoder, 0x80 | (c & 0x3F), src);
+    }
+}
+
+static int hex_digit_val(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static const char* decode_error(Decoder* decoder, const char* ptr, const char* msg) {
+    error_at_ptr(decoder->log, decoder->file_name, decoder->data, ptr, msg);
+    return NULL;
+}
+
+// Decodes the escape sequence after a backslash, and returns the position that
+// follows it, or NULL on error.
+static const char* decode_escape(Decoder* decoder, const char* escape) {
+    const char* ptr = escape + 1;
+    const char* end = decoder->end;
+    if (ptr == end)
+        return decode_error(decoder, escape, "unterminated string literal");
+    static const char simple_escapes[] = "'\"?\\abfnrtv";
+    static const char simple_chars[] = "'\"?\\\a\b\f\n\r\t\v";
+    const char* simple = *ptr ? strchr(simple_escapes, *ptr) : NULL;
+    if (simple) {
+        push_char(decoder, simple_chars[simple - simple_escapes], escape);
+        return ptr + 1;
+    }
+
+    uint32_t val = 0;
+    if (*ptr >= '0' && *ptr <= '7') {
+        for (int i = 0; i < 3 && ptr != end && *ptr >= '0' && *ptr <= '7'; ++i)
+            val = val * 8 + (*ptr++ - '0');
+    } else if (*ptr == 'x') {
+        if (++ptr == end || hex_digit_val(*ptr) < 0)
+            return decode_error(decoder, escape, "invalid hexadecimal escape sequence");
+        for (; ptr != end && hex_digit_val(*ptr) >= 0 && val <= UINT8_MAX; ++ptr)
+            val = val * 16 + hex_digit_val(*ptr);
+    } else if (*ptr == 'u' || *ptr == 'U') {
+        int digit_count = *ptr++ == 'u' ? 4 : 8;
+        for (int i = 0; i < digit_count; ++i, ++ptr) {
+            if (ptr == end || hex_digit_val(*ptr) < 0)
+                return decode_error(decoder, escape, "invalid universal character name");
+            val = val * 16 + hex_digit_val(*ptr);
+        }
+        if (val > 0x10FFFF || (val >= 0xD800 && val <= 0xDFFF))
+            return decode_error(decoder, escape, "invalid universal character name");
+        if (val == 0)
+            return decode_error(decoder, escape, "null character in string literal");
+        push_code_point(decoder, val, escape);
+        return ptr;
+    } else {
+        return decode_error(decoder, escape, "invalid escape sequence");
+    }
+    if (val > UINT8_MAX)
+        return decode_error(decoder, escape, "escape sequence out of range");
+    if (val == 0)
+        return decode_error(decoder, escape, "null character in string literal");
+    push_char(decoder, val, escape);
+    return ptr;
+}
+
+// Decodes the literal that starts at the given quote, and returns the position
+// that follows its closing quote, or NULL on error.
+static const char* decode_literal(Decoder* decoder, const char* quote) {
+    const char* ptr = quote + 1;
+    const char* end = decoder->end;
+    while (ptr != end && *ptr != '"') {
+        if (*ptr == '\n')
+            break;
+        if (*ptr == '\\' && end - ptr >= 2 && ptr[1] == '\n') {
+            // Line splice
+            ptr += 2;
+        } else if (*ptr == '\\' && end - ptr >= 3 && ptr[1] == '\r' && ptr[2] == '\n') {
+            ptr += 3;
+        } else if (*ptr == '\\') {
+            ptr = decode_escape(decoder, ptr);
+            if (!ptr)
+                return NULL;
+        } else {
+            push_char(decoder, *ptr, ptr);
+            ptr++;
+        }
+    }
+    if (ptr == end || *ptr != '"')
+        return decode_error(decoder, quote, "unterminated string literal");
+    return ptr + 1;
+}
+
+// Skips the white space, line splices and comments between adjacent literals
+static const char* skip_blanks(const char* ptr, const char* end) {
+    while (ptr != end) {
+        if (isspace((unsigned char)*ptr)) {
+            ptr++;
+        } else if (*ptr == '\\' && end - ptr >= 2 && isspace((unsigned char)ptr[1])) {
+            ptr++;
+        } else if (end - ptr >= 2 && !memcmp(ptr, "//", 2)) {
+            const char* line_end = memchr(ptr, '\n', end - ptr);
+            ptr = line_end ? line_end : end;
+        } else if (end - ptr >= 2 && !memcmp(ptr, "/*", 2)) {
+            const char* comment_end = find_str(ptr + 2, end, "*/", 2);
+            if (!comment_end)
+                break;
+            ptr = comment_end + 2;
+        } else {
+            break;
+        }
+    }
+    return ptr;
+}
+
+// Decodes the adjacent literals that start at the given quote, and returns the
+// position of the closing quote of the last one.
+static const char* decode_literals(Decoder* decoder, const char* quote) {
+    const char* last_quote = quote;
+    while (quote != decoder->end && *quote == '"') {
+        const char* next = decode_literal(decoder, quote);
+        if (!next)
+            return NULL;
+        last_quote = next - 1;
+        quote = skip_blanks(next, decoder->end);
+    }
+    return last_quote;
+}
+
+static bool find_spec_in_literals(
+    MemPool* mem_pool,
+    const char* file_name,
+    const char* data, size_t size,
+    const char* begin,
+    EmbeddedSpec* spec,
+    Log* log)
+{
+    const char* end = data + size;
+    const char* quote = memchr(begin, '"', end - begin);
+    if (!quote) {
+        error_at_ptr(log, file_name, data, begin, "no string literal after '" SPEC_MARKER "' marker");
+        return false;
+    }
+
+    Decoder decoder = { .file_name = file_name, .data = data, .end = end, .log = log };
+    const char* last_quote = decode_literals(&decoder, quote);
+    if (!last_quote)
+        return false;
+    size_t spec_size = decoder.size;
+    decoder.chars = mem_pool_alloc(mem_pool, spec_size + 1, alignof(char));
+    decoder.offsets = mem_pool_alloc(mem_pool, sizeof(size_t) * (spec_size + 1), alignof(size_t));
+    decoder.size = 0;
+    decode_literals(&decoder, quote);
+    decoder.chars[spec_size] = 0;
+    decoder.offsets[spec_size] = last_quote - data;
+
+    *spec = (EmbeddedSpec) {
+        .data = decoder.chars,
+        .range = {
+            .file_name = file_name,
+            .begin = { .row = 1, .col = 1, .bytes = 0 },
+            .end = { .bytes = spec_size }
+        },
+        .offsets = decoder.offsets
+    };
+    return true;
+}
+
+bool find_embedded_spec(MemPool* mem_pool, const char* file_name, const char* data, size_t size, EmbeddedSpec* spec, Log* log) {
+    const char* end = data + size;
+    const char* marker = find_str(data, end, SPEC_MARKER, strlen(SPEC_MARKER));
+    if (!marker) {
+        error_at_ptr(log, file_name, data, data, "no '" SPEC_MARKER "' marker found");
+        return false;
+    }
+
+    const char* line_end = memchr(marker, '\n', end - marker);
+    const char* begin = line_end ? line_end + 1 : end;
+    if (find_str(find_line_begin(data, marker), marker, "//", 2))
+        return find_spec_in_literals(mem_pool, file_name, data, size, begin, spec, log);
+
+    const char* spec_end = find_str(begin, end, "*/", 2);
+    if (!spec_end) {
+        error_at_ptr(log, file_name, data, marker, "unterminated comment after '" SPEC_MARKER "' marker");
+        return false;
+    }
+    *spec = (EmbeddedSpec) {
+        .data = data,
+        .range = {
+            .file_name = file_name,
+            .begin = get_pos(data, begin),
+            .end = get_pos(data, spec_end)
+        }
+    };
+    return true;
+}
+
+void map_embedded_diags(const EmbeddedSpec* spec, const char* data, Log* log, size_t first_diag) {
+    if (!spec->offsets)
+        return;
+    size_t spec_size = spec->range.end.bytes;
+    for (size_t i = first_diag; i < log->count; ++i) {
+        SourceRange* range = &log->diags[i].range;
+        size_t begin = range->begin.bytes < spec_size ? range->begin.bytes : spec_size;
+        size_t end = range->end.bytes < spec_size ? range->end.bytes : spec_size;
+        range->begin = get_pos(data, data + spec->offsets[begin]);
+        range->end = get_pos(data, data + spec->offsets[end]);
+    }
+}
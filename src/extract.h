@@ -0,0 +1,48 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+// Specifications can be embedded in a C or C++ source file, after a line that
+// contains the '@docopt' marker. Either the marker opens a block comment that
+// holds the specification:
+//
+//     /* @docopt
+//     Usage: prog [options]
+//     */
+//
+// or it is in a line comment, and the specification is held in the adjacent
+// string literals that follow:
+//
+//     // @docopt
+//     static const char usage[] =
+//         "Usage: prog [options]\n";
+//
+// Comments are lexed in place. String literals are decoded first, and the
+// positions of diagnostics are then mapped back to the source file.
+
+#include "token.h"
+
+#include <stdbool.h>
+
+typedef struct Log     Log;
+typedef struct MemPool MemPool;
+
+#define SPEC_MARKER "@docopt"
+
+typedef struct EmbeddedSpec {
+    // Either the source file, or the decoded string literals
+    const char* data;
+    SourceRange range;
+    // Offset in the source file of each decoded byte (and of the end of the
+    // last literal), or NULL for comments
+    size_t* offsets;
+} EmbeddedSpec;
+
+// Finds the embedded specification. For comments, the range begins after the
+// marker line and ends before the closing '*/'. Decoded literals are allocated
+// from the pool.
+bool find_embedded_spec(MemPool*, const char* file_name, const char* data, size_t size, EmbeddedSpec*, Log*);
+// Maps the positions of the diagnostics recorded from `first_diag` on to the
+// source file, when the specification was decoded from string literals.
+void map_embedded_diags(const EmbeddedSpec*, const char* data, Log*, size_t first_diag);
+
+#endif
@@ -0,0 +1,333 @@
+#include "grammar.h"
+#include "mem_pool.h"
+#include "str_table.h"
+#include "log.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdalign.h>
+#include <ctype.h>
+#include <limits.h>
+
+// Options and positionals are looked up by name while lowering, so that the
+// grammar is built in linear time even for machine-generated specifications.
+// Generated identifiers are also recorded, to report distinct names that map
+// to the same identifier.
+typedef struct Builder {
+    MemPool* mem_pool;
+    Grammar* grammar;
+    Log* log;
+    StrTable long_options;
+    StrTable commands;
+    StrTable args;
+    StrTable option_fields;
+    StrTable choice_names;
+    size_t short_options[UCHAR_MAX + 1];
+} Builder;
+
+static void count_many(const Syntax*, size_t* node_count, size_t* option_count);
+
+static void count_syntax(const Syntax* syntax, size_t* node_count, size_t* option_count) {
+    switch (syntax->tag) {
+        case SYNTAX_USAGE:
+            (*node_count)++;
+            count_many(syntax->usage.elems, node_count, option_count);
+            break;
+        case SYNTAX_OPTION: {
+            size_t len = syntax->option.is_short ? strlen(syntax->option.name) : 1;
+            *node_count += len + 1;
+            *option_count += len;
+            break;
+        }
+        case SYNTAX_BRACKETS:
+        case SYNTAX_PARENS:
+        case SYNTAX_OR:
+            (*node_count)++;
+            count_many(syntax->or_.elems, node_count, option_count);
+            break;
+        case SYNTAX_REPEAT:
+            (*node_count)++;
+            count_syntax(syntax->repeat.elem, node_count, option_count);
+            break;
+        default:
+            (*node_count)++;
+            break;
+    }
+}
+
+static void count_many(const Syntax* elems, size_t* node_count, size_t* option_count) {
+    for (const Syntax* elem = elems; elem; elem = elem->next)
+        count_syntax(elem, node_count, option_count);
+}
+
+static const char* make_field_name(MemPool* mem_pool, const char* prefix, const char* name) {
+    size_t prefix_len = strlen(prefix);
+    size_t name_len = strlen(name);
+    char* field = mem_pool_alloc(mem_pool, prefix_len + name_len + 1, alignof(char));
+    memcpy(field, prefix, prefix_len);
+    for (size_t i = 0; i < name_len; ++i)
+        field[prefix_len + i] = isalnum(name[i]) ? tolower(name[i]) : '_';
+    field[prefix_len + name_len] = 0;
+    return field;
+}
+
+// Choices are named after the field of their option and their value, in upper
+// case, as in the generated enumerations.
+static const char* make_choice_name(MemPool* mem_pool, const char* field, const char* choice) {
+    size_t field_len = strlen(field);
+    size_t choice_len = strlen(choice);
+    char* name = mem_pool_alloc(mem_pool, field_len + choice_len + 2, alignof(char));
+    memcpy(name, field, field_len);
+    name[field_len] = '_';
+    memcpy(name + field_len + 1, choice, choice_len + 1);
+    for (char* c = name; *c; ++c)
+        *c = isalnum((unsigned char)*c) ? toupper((unsigned char)*c) : '_';
+    return name;
+}
+
+static size_t find_option(const Builder* builder, bool is_short, const char* name) {
+    if (is_short)
+        return builder->short_options[(unsigned char)name[0]];
+    uint32_t index;
+    return find_in_str_table(&builder->long_options, name, &index) ? index : SIZE_MAX;
+}
+
+// The first option with a given name is found, as with a linear search
+static void register_option(Builder* builder, size_t index) {
+    const Option* option = &builder->grammar->options[index];
+    if (option->long_name)
+        insert_in_str_table(&builder->long_options, option->long_name, (uint32_t)index);
+    if (option->short_name && builder->short_options[(unsigned char)option->short_name] == SIZE_MAX)
+        builder->short_options[(unsigned char)option->short_name] = index;
+}
+
+static void check_option_names(Builder* builder, size_t index, const SourceRange* range) {
+    const Option* option = &builder->grammar->options[index];
+    if (!insert_in_str_table(&builder->option_fields, option->field, (uint32_t)index)) {
+        char short_name[2] = { option->short_name, 0 };
+        error_at(builder->log, range, "option '%s' maps to the field '%s', which is already used by another option",
+            option->long_name ? option->long_name : short_name, option->field);
+    }
+    for (size_t i = 0; i < option->choice_count; ++i) {
+        const char* name = make_choice_name(builder->mem_pool, option->field + 4, option->choices[i]);
+        if (!insert_in_str_table(&builder->choice_names, name, (uint32_t)index)) {
+            error_at(builder->log, range, "choice '%s' maps to the identifier '%s', which is already used by another choice",
+                option->choices[i], name);
+        }
+    }
+}
+
+static size_t add_option(Builder* builder, bool is_short, const char* name, const char* arg, const SourceRange* range) {
+    Grammar* grammar = builder->grammar;
+    size_t index = find_option(builder, is_short, name);
+    if (index != SIZE_MAX)
+        return index;
+    char* short_name = mem_pool_alloc(builder->mem_pool, 2, alignof(char));
+    short_name[0] = name[0];
+    short_name[1] = 0;
+    grammar->options[grammar->option_count] = (Option) {
+        .field = make_field_name(builder->mem_pool, "opt_", is_short ? short_name : name),
+        .long_name = is_short ? NULL : name,
+        .short_name = is_short ? name[0] : 0,
+        .arg = arg,
+        .arg_type = ARG_TYPE_STRING
+    };
+    register_option(builder, grammar->option_count);
+    check_option_names(builder, grammar->option_count, range);
+    return grammar->option_count++;
+}
+
+static void add_desc_options(Builder* builder, const Syntax* desc) {
+    Grammar* grammar = builder->grammar;
+    const Syntax* short_opt = NULL;
+    const Syntax* long_opt = NULL;
+    for (const Syntax* opt = desc->desc.elems; opt; opt = opt->next)
+        *(opt->option.is_short ? &short_opt : &long_opt) = opt;
+    const Syntax* first_opt = desc->desc.elems;
+    grammar->options[grammar->option_count++] = (Option) {
+        .field = make_field_name(builder->mem_pool, "opt_", (long_opt ? long_opt : short_opt)->option.name),
+        .long_name = long_opt ? long_opt->option.name : NULL,
+        .short_name = short_opt ? short_opt->option.name[0] : 0,
+        .arg = first_opt->option.arg,
+        .arg_type = desc->desc.arg_type,
+        .default_val = desc->desc.default_val,
+        .choices = desc->desc.choices,
+        .choice_count = desc->desc.choice_count
+    };
+    register_option(builder, grammar->option_count - 1);
+    check_option_names(builder, grammar->option_count - 1, &desc->range);
+}
+
+static size_t add_positional(Builder* builder, bool is_command, const char* name, const char* field, bool is_repeated, const SourceRange* range) {
+    Grammar* grammar = builder->grammar;
+    StrTable* positionals = is_command ? &builder->commands : &builder->args;
+    uint32_t index;
+    if (find_in_str_table(positionals, field, &index)) {
+        Positional* positional = &grammar->positionals[index];
+        if (strcmp(positional->name, name)) {
+            error_at(builder->log, range, "%s '%s' maps to the field '%s', which is already used by %s '%s'",
+                is_command ? "command" : "argument", name, field, is_command ? "command" : "argument", positional->name);
+        }
+        positional->is_repeated |= is_repeated;
+        return index;
+    }
+    insert_in_str_table(positionals, field, (uint32_t)grammar->positional_count);
+    grammar->positionals[grammar->positional_count] = (Positional) {
+        .field = field,
+        .name = name,
+        .is_command = is_command,
+        .is_repeated = is_repeated
+    };
+    return grammar->positional_count++;
+}
+
+static inline size_t begin_node(Builder* builder, NodeTag tag, size_t index) {
+    Grammar* grammar = builder->grammar;
+    grammar->nodes[grammar->node_count] = (Node) { .tag = tag, .index = index, .size = 1 };
+    return grammar->node_count++;
+}
+
+static inline void end_node(Builder* builder, size_t node) {
+    builder->grammar->nodes[node].size = builder->grammar->node_count - node;
+}
+
+static void lower_many(Builder*, const Syntax*, bool is_repeated);
+static void lower_one(Builder*, const Syntax*, bool is_repeated);
+
+static inline bool is_options_shortcut(const Syntax* syntax) {
+    const Syntax* elems = syntax->brackets.elems;
+    return
+        elems && !elems->next &&
+        elems->tag == SYNTAX_COMMAND &&
+        !strcmp(elems->command.name, "options");
+}
+
+static void lower_option(Builder* builder, const Syntax* syntax, bool is_repeated) {
+    const char* name = syntax->option.name;
+    if (!syntax->option.is_short || name[1] == 0) {
+        size_t index = add_option(builder, syntax->option.is_short, name, syntax->option.arg, &syntax->range);
+        builder->grammar->options[index].is_repeated |= is_repeated;
+        builder->grammar->options[index].is_in_usage = true;
+        begin_node(builder, NODE_OPTION, index);
+        return;
+    }
+
+    // Stacked short options such as '-abc' in a usage are lowered to '(-a -b -c)'
+    size_t node = begin_node(builder, NODE_SEQ, 0);
+    for (size_t i = 0; name[i]; ++i) {
+        size_t index = add_option(builder, true, name + i, name[i + 1] ? NULL : syntax->option.arg, &syntax->range);
+        builder->grammar->options[index].is_repeated |= is_repeated;
+        builder->grammar->options[index].is_in_usage = true;
+        begin_node(builder, NODE_OPTION, index);
+    }
+    end_node(builder, node);
+}
+
+static void lower(Builder* builder, const Syntax* syntax, bool is_repeated) {
+    size_t node;
+    switch (syntax->tag) {
+        case SYNTAX_COMMAND:
+            begin_node(builder, NODE_COMMAND, add_positional(builder, true, syntax->command.name,
+                make_field_name(builder->mem_pool, "cmd_", syntax->command.name), is_repeated, &syntax->range));
+            break;
+        case SYNTAX_STDIN:
+            begin_node(builder, NODE_COMMAND, add_positional(builder, true, "-", "cmd_stdin", is_repeated, &syntax->range));
+            break;
+        case SYNTAX_ARG:
+            begin_node(builder, NODE_ARG, add_positional(builder, false, syntax->arg.name,
+                make_field_name(builder->mem_pool, "arg_", syntax->arg.name), is_repeated, &syntax->range));
+            break;
+        case SYNTAX_OPTION:
+            lower_option(builder, syntax, is_repeated);
+            break;
+        case SYNTAX_BRACKETS:
+            if (is_options_shortcut(syntax)) {
+                begin_node(builder, NODE_ANY_OPTIONS, 0);
+                break;
+            }
+            node = begin_node(builder, NODE_OPTIONAL, 0);
+            lower_many(builder, syntax->brackets.elems, is_repeated);
+            end_node(builder, node);
+            break;
+        case SYNTAX_PARENS:
+            node = begin_node(builder, NODE_SEQ, 0);
+            lower_many(builder, syntax->parens.elems, is_repeated);
+            end_node(builder, node);
+            break;
+        case SYNTAX_OR:
+            node = begin_node(builder, NODE_OR, 0);
+            for (const Syntax* elem = syntax->or_.elems; elem; elem = elem->next)
+                lower_one(builder, elem, is_repeated);
+            end_node(builder, node);
+            break;
+        case SYNTAX_REPEAT:
+            node = begin_node(builder, NODE_REPEAT, 0);
+            lower_one(builder, syntax->repeat.elem, true);
+            end_node(builder, node);
+            break;
+        default:
+            // The separator '--' is handled when options are extracted
+            break;
+    }
+}
+
+static void lower_one(Builder* builder, const Syntax* syntax, bool is_repeated) {
+    // Alternatives and repetitions need exactly one child node to refer to
+    size_t node_count = builder->grammar->node_count;
+    lower(builder, syntax, is_repeated);
+    if (builder->grammar->node_count == node_count)
+        begin_node(builder, NODE_SEQ, 0);
+}
+
+static void lower_many(Builder* builder, const Syntax* elems, bool is_repeated) {
+    for (const Syntax* elem = elems; elem; elem = elem->next)
+        lower(builder, elem, is_repeated);
+}
+
+Grammar* build_grammar(MemPool* mem_pool, const Syntax* root, const char* doc, Log* log) {
+    assert(root->tag == SYNTAX_ROOT);
+
+    size_t node_count = 0, option_count = 0, usage_count = 0;
+    count_many(root->root.usages, &node_count, &option_count);
+    for (const Syntax* usage = root->root.usages; usage; usage = usage->next)
+        usage_count++;
+    for (const Syntax* desc = root->root.descs; desc; desc = desc->next)
+        option_count++;
+
+    Grammar* grammar = mem_pool_alloc(mem_pool, sizeof(Grammar), alignof(Grammar));
+    *grammar = (Grammar) {
+        .prog = root->root.usages->usage.prog,
+        .doc = doc,
+        .options = mem_pool_alloc(mem_pool, sizeof(Option) * option_count, alignof(Option)),
+        .positionals = mem_pool_alloc(mem_pool, sizeof(Positional) * node_count, alignof(Positional)),
+        .nodes = mem_pool_alloc(mem_pool, sizeof(Node) * node_count, alignof(Node)),
+        .usages = mem_pool_alloc(mem_pool, sizeof(size_t) * usage_count, alignof(size_t))
+    };
+
+    Builder builder = {
+        .mem_pool = mem_pool,
+        .grammar = grammar,
+        .log = log,
+        .long_options = make_str_table(),
+        .commands = make_str_table(),
+        .args = make_str_table(),
+        .option_fields = make_str_table(),
+        .choice_names = make_str_table()
+    };
+    for (size_t i = 0; i <= UCHAR_MAX; ++i)
+        builder.short_options[i] = SIZE_MAX;
+    for (const Syntax* desc = root->root.descs; desc; desc = desc->next)
+        add_desc_options(&builder, desc);
+    for (const Syntax* usage = root->root.usages; usage; usage = usage->next) {
+        size_t node = begin_node(&builder, NODE_SEQ, 0);
+        lower_many(&builder, usage->usage.elems, false);
+        end_node(&builder, node);
+        grammar->usages[grammar->usage_count++] = node;
+    }
+    free_str_table(&builder.long_options);
+    free_str_table(&builder.commands);
+    free_str_table(&builder.args);
+    free_str_table(&builder.option_fields);
+    free_str_table(&builder.choice_names);
+    return grammar;
+}
@@ -0,0 +1,68 @@
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#include "syntax.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct MemPool MemPool;
+
+// Usages are lowered to a flat array of nodes in pre-order. Every node records
+// the size of its subtree, so that children can be iterated without pointers.
+typedef enum {
+    NODE_COMMAND,
+    NODE_ARG,
+    NODE_OPTION,
+    NODE_SEQ,
+    NODE_OPTIONAL,
+    NODE_OR,
+    NODE_REPEAT,
+    // The '[options]' shortcut, which stands for the options that appear in no usage
+    NODE_ANY_OPTIONS
+} NodeTag;
+
+typedef struct Node {
+    NodeTag tag;
+    uint32_t index;
+    uint32_t size;
+} Node;
+
+typedef struct Option {
+    const char* field;
+    const char* long_name;
+    char short_name;
+    bool is_repeated;
+    bool is_in_usage;
+    const char* arg;
+    ArgType arg_type;
+    const char* default_val;
+    const char** choices;
+    size_t choice_count;
+} Option;
+
+typedef struct Positional {
+    const char* field;
+    const char* name;
+    bool is_command;
+    bool is_repeated;
+} Positional;
+
+typedef struct Grammar {
+    const char* prog;
+    const char* doc;
+    Option* options;
+    size_t option_count;
+    Positional* positionals;
+    size_t positional_count;
+    Node* nodes;
+    size_t node_count;
+    size_t* usages;
+    size_t usage_count;
+} Grammar;
+
+// Reports distinct names that map to the same generated identifier
+Grammar* build_grammar(MemPool*, const Syntax*, const char* doc, Log*);
+
+#endif
@@ -0,0 +1,178 @@
+#include "codegen.h"
+#include "grammar.h"
+#include "str_buf.h"
+#include "str_table.h"
+#include "image_format.h"
+#include "runtime.h"
+
+#include <assert.h>
+#include <string.h>
+
+typedef struct ImageWriter {
+    StrBuf strings;
+    StrTable interned;
+} ImageWriter;
+
+static void append_u8(StrBuf* buf, uint8_t val) {
+    append_char(buf, (char)val);
+}
+
+static void append_u32(StrBuf* buf, uint32_t val) {
+    for (int i = 0; i < 4; ++i)
+        append_u8(buf, (val >> (8 * i)) & 0xFF);
+}
+
+static uint32_t intern(ImageWriter* writer, const char* str) {
+    if (!str)
+        return IMAGE_NONE;
+    uint32_t offset;
+    if (find_in_str_table(&writer->interned, str, &offset))
+        return offset;
+    offset = writer->strings.size;
+    append_str(&writer->strings, str, strlen(str) + 1);
+    insert_in_str_table(&writer->interned, str, offset);
+    return offset;
+}
+
+static uint8_t get_option_kind(const Option* option) {
+    if (!option->arg)
+        return option->is_repeated ? DOCOPT_COUNT : DOCOPT_FLAG;
+    switch (option->arg_type) {
+        case ARG_TYPE_INT:    return DOCOPT_INT;
+        case ARG_TYPE_FLOAT:  return DOCOPT_FLOAT;
+        case ARG_TYPE_BOOL:   return DOCOPT_BOOL;
+        case ARG_TYPE_CHOICE: return DOCOPT_CHOICE;
+        default:              return DOCOPT_STRING;
+    }
+}
+
+static uint8_t get_positional_kind(const Positional* positional) {
+    if (positional->is_command)
+        return positional->is_repeated ? DOCOPT_COMMAND_COUNT : DOCOPT_COMMAND;
+    return positional->is_repeated ? DOCOPT_ARG_LIST : DOCOPT_ARG;
+}
+
+static uint8_t get_node_tag(NodeTag tag) {
+    switch (tag) {
+        case NODE_COMMAND:  return DOCOPT_NODE_COMMAND;
+        case NODE_ARG:      return DOCOPT_NODE_ARG;
+        case NODE_OPTION:   return DOCOPT_NODE_OPTION;
+        case NODE_SEQ:      return DOCOPT_NODE_SEQ;
+        case NODE_OPTIONAL: return DOCOPT_NODE_OPTIONAL;
+        case NODE_OR:       return DOCOPT_NODE_OR;
+        case NODE_REPEAT:   return DOCOPT_NODE_REPEAT;
+        case NODE_ANY_OPTIONS: return DOCOPT_NODE_ANY_OPTIONS;
+        default:
+            assert(false && "invalid node tag");
+            return 0;
+    }
+}
+
+static void append_section(StrBuf* buf, const StrBuf* section) {
+    append_str(buf, section->data, section->size);
+    while (buf->size % 4 != 0)
+        append_u8(buf, 0);
+}
+
+void emit_image(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options) {
+    ImageWriter writer = {
+        .strings = make_str_buf(),
+        .interned = make_str_table()
+    };
+    StrBuf option_buf = make_str_buf();
+    StrBuf positional_buf = make_str_buf();
+    StrBuf node_buf = make_str_buf();
+    StrBuf usage_buf = make_str_buf();
+    StrBuf choice_buf = make_str_buf();
+
+    uint32_t prog = intern(&writer, grammar->prog);
+    uint32_t doc = intern(&writer, grammar->doc);
+
+    uint32_t choice_count = 0;
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        const Option* option = &grammar->options[i];
+        uint8_t kind = get_option_kind(option);
+        append_u32(&option_buf, intern(&writer, option->long_name));
+        append_u32(&option_buf, intern(&writer, option->field));
+        append_u32(&option_buf, intern(&writer, option->arg ? option->default_val : NULL));
+        append_u32(&option_buf, choice_count);
+        append_u32(&option_buf, kind == DOCOPT_CHOICE ? option->choice_count : 0);
+        append_u8(&option_buf, option->short_name);
+        append_u8(&option_buf, kind);
+        append_u8(&option_buf, option->is_in_usage);
+        append_u8(&option_buf, 0);
+        if (kind != DOCOPT_CHOICE)
+            continue;
+        for (size_t j = 0; j < option->choice_count; ++j, ++choice_count)
+            append_u32(&choice_buf, intern(&writer, option->choices[j]));
+    }
+
+    for (size_t i = 0; i < grammar->positional_count; ++i) {
+        const Positional* positional = &grammar->positionals[i];
+        append_u32(&positional_buf, positional->is_command ? intern(&writer, positional->name) : IMAGE_NONE);
+        append_u32(&positional_buf, intern(&writer, positional->field));
+        append_u8(&positional_buf, get_positional_kind(positional));
+        for (int j = 0; j < 3; ++j)
+            append_u8(&positional_buf, 0);
+    }
+
+    for (size_t i = 0; i < grammar->node_count; ++i) {
+        append_u8(&node_buf, get_node_tag(grammar->nodes[i].tag));
+        for (int j = 0; j < 3; ++j)
+            append_u8(&node_buf, 0);
+        append_u32(&node_buf, grammar->nodes[i].index);
+        append_u32(&node_buf, grammar->nodes[i].size);
+    }
+
+    for (size_t i = 0; i < grammar->usage_count; ++i)
+        append_u32(&usage_buf, grammar->usages[i]);
+
+    uint32_t offset = sizeof(ImageHeader);
+    uint32_t option_offset = offset;     offset += option_buf.size;
+    uint32_t positional_offset = offset; offset += positional_buf.size;
+    uint32_t node_offset = offset;       offset += node_buf.size;
+    uint32_t usage_offset = offset;      offset += usage_buf.size;
+    uint32_t choice_offset = offset;     offset += choice_buf.size;
+    uint32_t string_offset = offset;     offset += writer.strings.size;
+    uint32_t size = (offset + 3) & ~UINT32_C(3);
+
+#ifndef NDEBUG
+    size_t begin = buf->size;
+#endif
+    append_str(buf, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    append_u32(buf, IMAGE_VERSION);
+    append_u32(buf, IMAGE_BYTE_ORDER);
+    append_u32(buf, size);
+    append_u32(buf, options->response_files ? IMAGE_RESPONSE_FILES : 0);
+    append_u32(buf, prog);
+    append_u32(buf, doc);
+    append_u32(buf, grammar->option_count);
+    append_u32(buf, option_offset);
+    append_u32(buf, grammar->positional_count);
+    append_u32(buf, positional_offset);
+    append_u32(buf, grammar->node_count);
+    append_u32(buf, node_offset);
+    append_u32(buf, grammar->usage_count);
+    append_u32(buf, usage_offset);
+    append_u32(buf, choice_count);
+    append_u32(buf, choice_offset);
+    append_u32(buf, writer.strings.size);
+    append_u32(buf, string_offset);
+    assert(buf->size - begin == sizeof(ImageHeader));
+
+    append_section(buf, &option_buf);
+    append_section(buf, &positional_buf);
+    append_section(buf, &node_buf);
+    append_section(buf, &usage_buf);
+    append_section(buf, &choice_buf);
+    append_section(buf, &writer.strings);
+    assert(buf->size - begin == size);
+
+    free_str_buf(&option_buf);
+    free_str_buf(&positional_buf);
+    free_str_buf(&node_buf);
+    free_str_buf(&usage_buf);
+    free_str_buf(&choice_buf);
+    free_str_buf(&writer.strings);
+    free_str_table(&writer.interned);
+}
@@ -0,0 +1,66 @@
+#ifndef IMAGE_FORMAT_H
+#define IMAGE_FORMAT_H
+
+// Binary format for checked grammars ("grammar images"). An image is a single
+// position-independent block: every reference is an offset from the beginning
+// of the image, or from the beginning of the string section for strings. All
+// fields are little-endian, and every section is aligned to 4 bytes, so that a
+// suitably aligned image can be used in place, either mapped from a file or
+// embedded in a binary.
+
+#include <stdint.h>
+
+#define IMAGE_MAGIC      "DOCOPTI"
+#define IMAGE_VERSION    2
+#define IMAGE_BYTE_ORDER UINT32_C(0x01020304)
+#define IMAGE_NONE       UINT32_C(0xFFFFFFFF)
+
+enum {
+    IMAGE_RESPONSE_FILES = 0x1
+};
+
+typedef struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t prog;
+    uint32_t doc;
+    uint32_t option_count, options;
+    uint32_t positional_count, positionals;
+    uint32_t node_count, nodes;
+    uint32_t usage_count, usages;
+    uint32_t choice_count, choices;
+    uint32_t strings_size, strings;
+} ImageHeader;
+
+// Option and positional kinds, as well as node tags, use the values of the
+// generated parser runtime (DOCOPT_FLAG, DOCOPT_COMMAND, DOCOPT_NODE_SEQ, ...).
+typedef struct ImageOption {
+    uint32_t long_name;
+    uint32_t field;
+    uint32_t default_val;
+    uint32_t first_choice;
+    uint32_t choice_count;
+    uint8_t short_name;
+    uint8_t kind;
+    uint8_t is_in_usage;
+    uint8_t pad;
+} ImageOption;
+
+typedef struct ImagePositional {
+    uint32_t name;
+    uint32_t field;
+    uint8_t kind;
+    uint8_t pad[3];
+} ImagePositional;
+
+typedef struct ImageNode {
+    uint8_t tag;
+    uint8_t pad[3];
+    uint32_t index;
+    uint32_t size;
+} ImageNode;
+
+#endif
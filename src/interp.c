@@ -0,0 +1,337 @@
+#include "interp.h"
+#include "image_format.h"
+
+#include <stdint.h>
+#include <assert.h>
+
+// Nodes and usages are used in place, directly from the image
+static_assert(sizeof(ImageHeader) == 80, "invalid image header layout");
+static_assert(sizeof(ImageOption) == 24, "invalid image option layout");
+static_assert(sizeof(ImagePositional) == 12, "invalid image positional layout");
+static_assert(sizeof(DocoptNode) == sizeof(ImageNode), "incompatible node layout");
+static_assert(offsetof(DocoptNode, index) == offsetof(ImageNode, index), "incompatible node layout");
+static_assert(offsetof(DocoptNode, size) == offsetof(ImageNode, size), "incompatible node layout");
+static_assert(sizeof(unsigned) == sizeof(uint32_t), "incompatible usage layout");
+
+static int image_error(char* error, const char* msg) {
+    snprintf(error, DOCOPT_ERROR_SIZE, "%s", msg);
+    return DOCOPT_ERROR;
+}
+
+static bool is_valid_section(const ImageHeader* header, uint32_t offset, uint32_t count, size_t elem_size) {
+    return
+        offset % 4 == 0 &&
+        offset >= sizeof(ImageHeader) &&
+        offset <= header->size &&
+        count <= (header->size - offset) / elem_size;
+}
+
+static bool is_valid_string(const ImageHeader* header, uint32_t offset, bool is_optional) {
+    return offset < header->strings_size || (is_optional && offset == IMAGE_NONE);
+}
+
+static const char* get_string(const DocoptImage* image, const ImageHeader* header, uint32_t offset) {
+    return offset == IMAGE_NONE ? NULL : image->data + header->strings + offset;
+}
+
+static bool is_valid_header(const ImageHeader* header) {
+    return
+        is_valid_section(header, header->options, header->option_count, sizeof(ImageOption)) &&
+        is_valid_section(header, header->positionals, header->positional_count, sizeof(ImagePositional)) &&
+        is_valid_section(header, header->nodes, header->node_count, sizeof(ImageNode)) &&
+        is_valid_section(header, header->usages, header->usage_count, sizeof(uint32_t)) &&
+        is_valid_section(header, header->choices, header->choice_count, sizeof(uint32_t)) &&
+        is_valid_section(header, header->strings, header->strings_size, 1) &&
+        is_valid_string(header, header->prog, false) &&
+        is_valid_string(header, header->doc, false);
+}
+
+static bool is_valid_option(const ImageHeader* header, const ImageOption* option) {
+    return
+        option->kind <= DOCOPT_CHOICE &&
+        option->is_in_usage <= 1 &&
+        (option->long_name != IMAGE_NONE || option->short_name != 0) &&
+        is_valid_string(header, option->long_name, true) &&
+        is_valid_string(header, option->field, false) &&
+        is_valid_string(header, option->default_val, true) &&
+        option->first_choice <= header->choice_count &&
+        option->choice_count <= header->choice_count - option->first_choice &&
+        (option->kind == DOCOPT_CHOICE) == (option->choice_count > 0);
+}
+
+static bool is_valid_positional(const ImageHeader* header, const ImagePositional* positional) {
+    bool is_command = positional->kind == DOCOPT_COMMAND || positional->kind == DOCOPT_COMMAND_COUNT;
+    return
+        positional->kind <= DOCOPT_ARG_LIST &&
+        is_valid_string(header, positional->name, !is_command) &&
+        is_valid_string(header, positional->field, false);
+}
+
+// Checks that the subtree sizes are consistent, so that the matcher never
+// leaves the node array, and that leaves refer to existing options or arguments.
+static bool is_valid_node(const ImageHeader* header, const ImagePositional* positionals, const ImageNode* nodes, uint32_t i) {
+    const ImageNode* node = &nodes[i];
+    if (node->size == 0 || node->size > header->node_count - i)
+        return false;
+    switch (node->tag) {
+        case DOCOPT_NODE_COMMAND:
+        case DOCOPT_NODE_ARG:
+            return
+                node->size == 1 &&
+                node->index < header->positional_count &&
+                (node->tag == DOCOPT_NODE_COMMAND) == (positionals[node->index].kind <= DOCOPT_COMMAND_COUNT);
+        case DOCOPT_NODE_OPTION:
+            return node->size == 1 && node->index < header->option_count;
+        case DOCOPT_NODE_ANY_OPTIONS:
+            return node->size == 1;
+        case DOCOPT_NODE_SEQ:
+        case DOCOPT_NODE_OPTIONAL:
+        case DOCOPT_NODE_OR:
+        case DOCOPT_NODE_REPEAT: {
+            uint32_t child = i + 1, end = i + node->size, child_count = 0;
+            for (; child < end && nodes[child].size > 0; child += nodes[child].size)
+                child_count++;
+            return child == end && (node->tag != DOCOPT_NODE_REPEAT || child_count == 1);
+        }
+        default:
+            return false;
+    }
+}
+
+static int validate_image(const ImageHeader* header, const char* data, char* error) {
+    if (!is_valid_header(header))
+        return image_error(error, "invalid grammar image header");
+    if (header->strings_size == 0 || data[header->strings + header->strings_size - 1] != 0)
+        return image_error(error, "invalid string section in grammar image");
+
+    const ImageOption* options = (const ImageOption*)(data + header->options);
+    for (uint32_t i = 0; i < header->option_count; ++i) {
+        if (!is_valid_option(header, &options[i]))
+            return image_error(error, "invalid option in grammar image");
+    }
+    const ImagePositional* positionals = (const ImagePositional*)(data + header->positionals);
+    for (uint32_t i = 0; i < header->positional_count; ++i) {
+        if (!is_valid_positional(header, &positionals[i]))
+            return image_error(error, "invalid positional argument in grammar image");
+    }
+    const ImageNode* nodes = (const ImageNode*)(data + header->nodes);
+    for (uint32_t i = 0; i < header->node_count; ++i) {
+        if (!is_valid_node(header, positionals, nodes, i))
+            return image_error(error, "invalid usage pattern in grammar image");
+    }
+    const uint32_t* usages = (const uint32_t*)(data + header->usages);
+    for (uint32_t i = 0; i < header->usage_count; ++i) {
+        if (usages[i] >= header->node_count)
+            return image_error(error, "invalid usage in grammar image");
+    }
+    const uint32_t* choices = (const uint32_t*)(data + header->choices);
+    for (uint32_t i = 0; i < header->choice_count; ++i) {
+        if (!is_valid_string(header, choices[i], false))
+            return image_error(error, "invalid choice in grammar image");
+    }
+    return DOCOPT_OK;
+}
+
+// Builds the runtime tables, which contain pointers and therefore cannot be
+// stored in the image. All of them live in a single allocation.
+static int build_tables(DocoptImage* image, const ImageHeader* header, char* error) {
+    size_t field_count = header->option_count + header->positional_count;
+    size_t values_size    = sizeof(DocoptValue) * field_count;
+    size_t options_size   = sizeof(DocoptOption) * header->option_count;
+    size_t positionals_size = sizeof(DocoptPositional) * header->positional_count;
+    size_t choices_size   = sizeof(const char*) * header->choice_count;
+    size_t names_size     = sizeof(const char*) * field_count;
+    size_t shorts_size    = sizeof(DocoptShort) * 256;
+    size_t exit_options_size = sizeof(unsigned) * header->option_count;
+    char* tables = calloc(1, values_size + options_size + positionals_size + choices_size + names_size + shorts_size + exit_options_size);
+    if (!tables)
+        return image_error(error, "not enough memory");
+
+    DocoptValue* defaults         = (DocoptValue*)tables;
+    DocoptOption* options         = (DocoptOption*)(tables + values_size);
+    DocoptPositional* positionals = (DocoptPositional*)((char*)options + options_size);
+    const char** choices          = (const char**)((char*)positionals + positionals_size);
+    const char** field_names      = (const char**)((char*)choices + choices_size);
+    DocoptShort* shorts           = (DocoptShort*)((char*)field_names + names_size);
+    unsigned* exit_options        = (unsigned*)((char*)shorts + shorts_size);
+    size_t exit_option_count      = 0;
+
+    const uint32_t* image_choices = (const uint32_t*)(image->data + header->choices);
+    for (uint32_t i = 0; i < header->choice_count; ++i)
+        choices[i] = get_string(image, header, image_choices[i]);
+
+    const ImageOption* image_options = (const ImageOption*)(image->data + header->options);
+    for (uint32_t i = 0; i < header->option_count; ++i) {
+        const ImageOption* option = &image_options[i];
+        options[i] = (DocoptOption) {
+            .long_name = get_string(image, header, option->long_name),
+            .short_name = (char)option->short_name,
+            .kind = option->kind,
+            .is_in_usage = option->is_in_usage,
+            .offset = sizeof(DocoptValue) * i,
+            .choices = option->choice_count > 0 ? choices + option->first_choice : NULL,
+            .choice_count = option->choice_count
+        };
+        field_names[i] = get_string(image, header, option->field);
+        if (option->short_name)
+            shorts[option->short_name] = (DocoptShort) { option->kind >= DOCOPT_STRING ? DOCOPT_SHORT_VALUE : DOCOPT_SHORT_FLAG, i };
+        if (docopt_is_exit_option(&options[i]))
+            exit_options[exit_option_count++] = i;
+    }
+
+    const ImagePositional* image_positionals = (const ImagePositional*)(image->data + header->positionals);
+    for (uint32_t i = 0; i < header->positional_count; ++i) {
+        positionals[i] = (DocoptPositional) {
+            .name = get_string(image, header, image_positionals[i].name),
+            .kind = image_positionals[i].kind,
+            .offset = sizeof(DocoptValue) * (header->option_count + i)
+        };
+        field_names[header->option_count + i] = get_string(image, header, image_positionals[i].field);
+    }
+
+    image->tables = tables;
+    image->defaults = defaults;
+    image->field_names = field_names;
+    image->field_count = field_count;
+    image->spec = (DocoptSpec) {
+        .prog = get_string(image, header, header->prog),
+        .options = options,
+        .option_count = header->option_count,
+        .shorts = shorts,
+        .positionals = positionals,
+        .positional_count = header->positional_count,
+        .nodes = (const DocoptNode*)(image->data + header->nodes),
+        .usages = (const unsigned*)(image->data + header->usages),
+        .usage_count = header->usage_count,
+        .response_files = header->flags & IMAGE_RESPONSE_FILES,
+        .exit_options = exit_options,
+        .exit_option_count = exit_option_count
+    };
+
+    // Default values are converted once, when the image is opened
+    DocoptMem* mem = NULL;
+    DocoptContext context = {
+        .spec = &image->spec,
+        .args = defaults,
+        .mem = &mem,
+        .error = error
+    };
+    for (uint32_t i = 0; i < header->option_count; ++i) {
+        const char* default_val = get_string(image, header, image_options[i].default_val);
+        if (default_val && options[i].kind >= DOCOPT_STRING && docopt_store_option(&context, &options[i], default_val) != DOCOPT_OK)
+            return DOCOPT_ERROR;
+    }
+    return DOCOPT_OK;
+}
+
+int docopt_open_image(DocoptImage* image, const void* data, size_t size, char* error) {
+    memset(image, 0, sizeof(DocoptImage));
+    const ImageHeader* header = data;
+    if ((uintptr_t)data % 4 != 0 || size < sizeof(ImageHeader) || memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)))
+        return image_error(error, "not a grammar image");
+    if (header->byte_order != IMAGE_BYTE_ORDER)
+        return image_error(error, "grammar image has an incompatible byte order");
+    if (header->version != IMAGE_VERSION)
+        return image_error(error, "unsupported grammar image version");
+    if (header->size > size)
+        return image_error(error, "truncated grammar image");
+
+    image->data = data;
+    image->size = header->size;
+    if (validate_image(header, image->data, error) != DOCOPT_OK)
+        return DOCOPT_ERROR;
+    image->doc = get_string(image, header, header->doc);
+    if (build_tables(image, header, error) != DOCOPT_OK) {
+        docopt_close_image(image);
+        return DOCOPT_ERROR;
+    }
+    return DOCOPT_OK;
+}
+
+int docopt_load_image(DocoptImage* image, const char* file_name, char* error) {
+    void* map = NULL;
+    size_t size = 0;
+#ifdef DOCOPT_HAS_MMAP
+    int fd = open(file_name, O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        if (fd >= 0)
+            close(fd);
+        snprintf(error, DOCOPT_ERROR_SIZE, "cannot open grammar image '%s'", file_name);
+        return DOCOPT_ERROR;
+    }
+    size = (size_t)file_stat.st_size;
+    if (size > 0 && (map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        map = NULL;
+    close(fd);
+#else
+    FILE* file = fopen(file_name, "rb");
+    if (!file) {
+        snprintf(error, DOCOPT_ERROR_SIZE, "cannot open grammar image '%s'", file_name);
+        return DOCOPT_ERROR;
+    }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (file_size > 0 && (map = malloc((size_t)file_size))) {
+        size = fread(map, 1, (size_t)file_size, file);
+        if (size != (size_t)file_size)
+            free(map), map = NULL;
+    }
+    fclose(file);
+#endif
+    if (!map) {
+        snprintf(error, DOCOPT_ERROR_SIZE, "cannot read grammar image '%s'", file_name);
+        return DOCOPT_ERROR;
+    }
+    if (docopt_open_image(image, map, size, error) != DOCOPT_OK) {
+#ifdef DOCOPT_HAS_MMAP
+        munmap(map, size);
+#else
+        free(map);
+#endif
+        return DOCOPT_ERROR;
+    }
+    image->map = map;
+    image->map_size = size;
+    return DOCOPT_OK;
+}
+
+void docopt_close_image(DocoptImage* image) {
+    free(image->tables);
+    if (image->map) {
+#ifdef DOCOPT_HAS_MMAP
+        munmap(image->map, image->map_size);
+#else
+        free(image->map);
+#endif
+    }
+    memset(image, 0, sizeof(DocoptImage));
+}
+
+int docopt_find_field(const DocoptImage* image, const char* field) {
+    for (size_t i = 0; i < image->field_count; ++i) {
+        if (!strcmp(image->field_names[i], field))
+            return (int)i;
+    }
+    return -1;
+}
+
+int docopt_interpret(const DocoptImage* image, DocoptValues* values, int argc, char** argv) {
+    values->mem = NULL;
+    values->error[0] = 0;
+    values->values = malloc(sizeof(DocoptValue) * (image->field_count + 1));
+    if (!values->values) {
+        snprintf(values->error, DOCOPT_ERROR_SIZE, "not enough memory");
+        return DOCOPT_ERROR;
+    }
+    memcpy(values->values, image->defaults, sizeof(DocoptValue) * image->field_count);
+    return docopt_parse(&image->spec, values->values, &values->mem, values->error, argc - 1, argv + 1);
+}
+
+void docopt_free_values(DocoptValues* values) {
+    free(values->values);
+    docopt_free(values->mem);
+    values->values = NULL;
+    values->mem = NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+// Interpreter for grammar images produced by 'docoptc --target image'. Images
+// are used in place, and interpreted with the same runtime as generated
+// parsers. Results are stored in one value per field, in the order given by
+// the image: options first, then positional arguments and commands.
+
+#include "runtime.h"
+
+typedef union DocoptValue {
+    bool flag;
+    unsigned count;
+    const char* str;
+    long long int_val;
+    double float_val;
+    int choice;
+    DocoptList list;
+} DocoptValue;
+
+typedef struct DocoptImage {
+    const char* data;
+    size_t size;
+    void* map;
+    size_t map_size;
+    const char* doc;
+    DocoptSpec spec;
+    const char** field_names;
+    size_t field_count;
+    DocoptValue* defaults;
+    void* tables;
+} DocoptImage;
+
+typedef struct DocoptValues {
+    DocoptValue* values;
+    DocoptMem* mem;
+    char error[DOCOPT_ERROR_SIZE];
+} DocoptValues;
+
+// Opens an image held in memory, which must be aligned to 4 bytes and must
+// outlive the DocoptImage object. On failure, a message is written in `error`.
+int docopt_open_image(DocoptImage*, const void* data, size_t size, char* error);
+// Maps an image file in memory and opens it
+int docopt_load_image(DocoptImage*, const char* file_name, char* error);
+void docopt_close_image(DocoptImage*);
+
+// Returns the index of the value for the given field (e.g. "opt_verbose"), or -1
+int docopt_find_field(const DocoptImage*, const char* field);
+int docopt_interpret(const DocoptImage*, DocoptValues*, int argc, char** argv);
+void docopt_free_values(DocoptValues*);
+
+#endif
@@ -6,20 +6,17 @@
 #include <string.h>
 #include <ctype.h>
 
-Lexer make_lexer(const char* file_name, const char* file_data) {
+Lexer make_range_lexer(const char* file_data, const SourceRange* range) {
     return (Lexer) {
-        .file_name = file_name,
+        .file_name = range->file_name,
         .file_data = file_data,
-        .pos = {
-            .row = 1,
-            .col = 1,
-            .bytes = 0
-        }
+        .file_size = range->end.bytes,
+        .pos = range->begin
     };
 }
 
 static inline char peek_char(const Lexer* lexer) {
-    return lexer->file_data[lexer->pos.bytes];
+    return lexer->pos.bytes < lexer->file_size ? lexer->file_data[lexer->pos.bytes] : 0;
 }
 
 static inline bool eof_reached(const Lexer* lexer) {
@@ -6,10 +6,12 @@
 typedef struct Lexer {
     const char* file_name;
     const char* file_data;
+    size_t file_size;
     SourcePos pos;
 } Lexer;
 
-Lexer make_lexer(const char* file_name, const char* file_data);
+// Lexes the given range of a file, with positions relative to the whole file
+Lexer make_range_lexer(const char* file_data, const SourceRange*);
 size_t eat_spaces(Lexer* lexer);
 void skip_line(Lexer* lexer);
 Token lex(Lexer* lexer);
@@ -0,0 +1,111 @@
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#define MIN_LOG_CAP 8
+
+Log make_log(void) {
+    return (Log) { .diags = NULL, .count = 0, .cap = 0, .error_count = 0, .max_count = 0 };
+}
+
+void free_log(Log* log) {
+    for (size_t i = 0; i < log->count; ++i)
+        free(log->diags[i].msg);
+    free(log->diags);
+}
+
+void print_log(FILE* file, const Log* log) {
+    for (size_t i = 0; i < log->count; ++i) {
+        const SourceRange* range = &log->diags[i].range;
+        fprintf(file, "error in %s(%"PRIu32":%"PRIu32" - %"PRIu32":%"PRIu32"): %s\n",
+            range->file_name, range->begin.row, range->begin.col, range->end.row, range->end.col,
+            log->diags[i].msg);
+    }
+    if (is_log_full(log))
+        fprintf(file, "stopped after %zu errors\n", log->count);
+}
+
+static void print_json_str(FILE* file, const char* str) {
+    fputc('"', file);
+    for (; *str; ++str) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+void print_log_json(FILE* file, const Log* log) {
+    fputc('[', file);
+    for (size_t i = 0; i < log->count; ++i) {
+        const SourceRange* range = &log->diags[i].range;
+        fprintf(file, "%s\n  {\"file\": ", i == 0 ? "" : ",");
+        print_json_str(file, range->file_name);
+        fprintf(file, ", \"begin\": {\"row\": %"PRIu32", \"col\": %"PRIu32"}, \"end\": {\"row\": %"PRIu32", \"col\": %"PRIu32"}, \"message\": ",
+            range->begin.row, range->begin.col, range->end.row, range->end.col);
+        print_json_str(file, log->diags[i].msg);
+        fputc('}', file);
+    }
+    fprintf(file, "%s]\n", log->count > 0 ? "\n" : "");
+}
+
+bool is_log_full(const Log* log) {
+    return log->max_count > 0 && log->count >= log->max_count;
+}
+
+static void push_diag(Log* log, const Diag* diag) {
+    if (log->count >= log->cap) {
+        log->cap = log->cap < MIN_LOG_CAP ? MIN_LOG_CAP : log->cap * 2;
+        log->diags = realloc(log->diags, sizeof(Diag) * log->cap);
+    }
+    log->diags[log->count++] = *diag;
+}
+
+void merge_log(Log* log, Log* other) {
+    for (size_t i = 0; i < other->count; ++i) {
+        if (is_log_full(log)) {
+            free(other->diags[i].msg);
+            continue;
+        }
+        push_diag(log, &other->diags[i]);
+    }
+    log->error_count += other->error_count;
+    free(other->diags);
+    *other = make_log();
+}
+
+static bool is_same_diag(const Diag* diag, const SourceRange* range, const char* msg) {
+    return
+        diag->range.begin.bytes == range->begin.bytes &&
+        diag->range.end.bytes == range->end.bytes &&
+        !strcmp(diag->range.file_name, range->file_name) &&
+        !strcmp(diag->msg, msg);
+}
+
+void error_at(Log* log, const SourceRange* range, const char* format_str, ...) {
+    log->error_count++;
+    if (is_log_full(log))
+        return;
+
+    va_list args, args_copy;
+    va_start(args, format_str);
+    va_copy(args_copy, args);
+    int len = vsnprintf(NULL, 0, format_str, args);
+    char* msg = malloc(len + 1);
+    vsnprintf(msg, len + 1, format_str, args_copy);
+    va_end(args_copy);
+    va_end(args);
+
+    if (log->count > 0 && is_same_diag(&log->diags[log->count - 1], range, msg)) {
+        free(msg);
+        return;
+    }
+    push_diag(log, &(Diag) { .range = *range, .msg = msg });
+}
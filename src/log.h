@@ -0,0 +1,35 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "token.h"
+
+#include <stdio.h>
+
+typedef struct Diag {
+    SourceRange range;
+    char* msg;
+} Diag;
+
+// Diagnostics are recorded up to a maximum count, after which errors are only
+// counted. An error identical to the previous one is not recorded either.
+typedef struct Log {
+    Diag* diags;
+    size_t count, cap;
+    // Number of errors, including those that were not recorded
+    size_t error_count;
+    // No limit if zero
+    size_t max_count;
+} Log;
+
+Log make_log(void);
+void free_log(Log*);
+void print_log(FILE*, const Log*);
+// Prints a JSON array of objects with 'file', 'begin' and 'end' (each with
+// 'row' and 'col'), and 'message' fields
+void print_log_json(FILE*, const Log*);
+bool is_log_full(const Log*);
+// Moves the diagnostics of another log at the end of the first one
+void merge_log(Log*, Log* other);
+void error_at(Log*, const SourceRange*, const char* format_str, ...);
+
+#endif
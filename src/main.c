@@ -1,29 +1,403 @@
+#include "docoptc.h"
 #include "utils.h"
-#include "lexer.h"
-#include "parser.h"
 #include "syntax.h"
 #include "mem_pool.h"
+#include "profile.h"
+#include "extract.h"
+#include "watch.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 
-static bool compile_file(const char* file_name) {
-    char* file_data = read_file(file_name);
-    if (!file_data)
-        return false;
+// How diagnostics are reported, as given on the command line
+static size_t max_errors = 20;
+static bool json_errors = false;
+
+static Log make_cli_log(void) {
+    Log log = make_log();
+    log.max_count = max_errors;
+    return log;
+}
+
+static void print_cli_log(const Log* log) {
+    if (log->error_count == 0)
+        return;
+    if (json_errors)
+        print_log_json(stderr, log);
+    else
+        print_log(stderr, log);
+}
+
+static bool print_file_syntax(const char* file_name, const char* file_data, size_t file_size, const CodegenOptions* options, Log* log) {
     MemPool mem_pool = new_mem_pool();
-    Lexer lexer = make_lexer(file_name, file_data);
-    Parser parser = make_parser(&mem_pool, &lexer);
-    Syntax* syntax = parse(&parser);
-    check_syntax(syntax);
-    print_syntax(stdout, syntax);
-    free(file_data);
+    Syntax* syntax = parse_spec(&mem_pool, file_name, file_data, file_size, options, log);
+    if (syntax)
+        print_syntax(stdout, syntax);
     free_mem_pool(&mem_pool);
+    return syntax != NULL;
+}
+
+static bool load_profile(const char* file_name, Profile* profile, Log* log) {
+    size_t file_size = 0;
+    char* file_data = read_file(file_name, &file_size);
+    if (!file_data) {
+        fprintf(stderr, "cannot open profile '%s'\n", file_name);
+        return false;
+    }
+    bool ok = parse_profile(file_name, file_data, file_size, profile, log);
+    free(file_data);
+    return ok;
+}
+
+static bool compile_file(const char* file_name, const char* profile_name, bool only_syntax, CodegenOptions* options) {
+    size_t file_size = 0;
+    char* file_data = read_file(file_name, &file_size);
+    if (!file_data) {
+        fprintf(stderr, "cannot open file '%s'\n", file_name);
+        return false;
+    }
+
+    Log log = make_cli_log();
+    Profile profile = { .prog = NULL };
+    bool ok;
+    if (only_syntax)
+        ok = print_file_syntax(file_name, file_data, file_size, options, &log);
+    else if ((ok = !profile_name || load_profile(profile_name, &profile, &log))) {
+        StrBuf output = make_str_buf();
+        options->profile = profile_name ? &profile : NULL;
+        ok = compile_spec(file_name, file_data, file_size, options, &output, &log);
+        if (ok)
+            fwrite(output.data, 1, output.size, stdout);
+        if (ok && options->stats) {
+            fprintf(stderr, "%s: %zu bytes of code, %zu states, %zu functions\n", file_name,
+                options->stats->code_size, options->stats->state_count, options->stats->function_count);
+        }
+        free_str_buf(&output);
+    }
+    print_cli_log(&log);
+    free_log(&log);
+    free_profile(&profile);
+    free(file_data);
+    return ok;
+}
+
+static bool compile_files(const char* module, char** file_names, size_t file_count, CodegenOptions* options) {
+    SpecSource* specs = calloc(file_count, sizeof(SpecSource));
+    bool ok = true;
+    for (size_t i = 0; i < file_count && ok; ++i) {
+        specs[i].file_name = file_names[i];
+        specs[i].data = read_file(file_names[i], &specs[i].size);
+        if (!specs[i].data) {
+            fprintf(stderr, "cannot open file '%s'\n", file_names[i]);
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        Log log = make_cli_log();
+        StrBuf output = make_str_buf();
+        ok = compile_module(module, specs, file_count, options, &output, &log);
+        if (ok)
+            fwrite(output.data, 1, output.size, stdout);
+        if (ok && options->stats) {
+            fprintf(stderr, "%s: %zu bytes of code, %zu states, %zu functions\n", module,
+                options->stats->code_size, options->stats->state_count, options->stats->function_count);
+        }
+        free_str_buf(&output);
+        print_cli_log(&log);
+        free_log(&log);
+    }
+    for (size_t i = 0; i < file_count; ++i)
+        free((char*)specs[i].data);
+    free(specs);
+    return ok;
+}
+
+// Outputs are written to a temporary file first, and then renamed, so that
+// build tools never see a partial output. Identical outputs are not written,
+// which keeps their modification time.
+static bool write_if_changed(const char* file_name, const StrBuf* output, bool* is_changed) {
+    size_t file_size = 0;
+    char* file_data = read_file(file_name, &file_size);
+    *is_changed = !file_data || file_size != output->size || memcmp(file_data, output->data, file_size);
+    free(file_data);
+    if (!*is_changed)
+        return true;
+
+    size_t len = strlen(file_name);
+    char* tmp_name = malloc(len + 5);
+    memcpy(tmp_name, file_name, len);
+    memcpy(tmp_name + len, ".tmp", 5);
+    FILE* file = fopen(tmp_name, "wb");
+    bool ok = file && fwrite(output->data, 1, output->size, file) == output->size;
+    ok &= file && !fclose(file);
+    ok = ok && !rename(tmp_name, file_name);
+    if (!ok) {
+        fprintf(stderr, "cannot write file '%s'\n", file_name);
+        remove(tmp_name);
+    }
+    free(tmp_name);
+    return ok;
+}
+
+// Outputs of watched files are placed next to them: 'dir/tool.txt' is compiled
+// to 'dir/tool_args.h', 'dir/tool_args.hpp', 'dir/tool.img' or 'dir/tool.bash'.
+static char* get_output_name(const char* file_name, Target target) {
+    const char* base_name = strrchr(file_name, '/');
+    base_name = base_name ? base_name + 1 : file_name;
+    const char* dot = strrchr(base_name, '.');
+    size_t len = dot && dot != base_name ? (size_t)(dot - file_name) : strlen(file_name);
+    const char* suffix =
+        target == TARGET_IMAGE ? ".img" :
+        target == TARGET_CPP ? "_args.hpp" :
+        target == TARGET_BASH ? ".bash" : "_args.h";
+    char* output_name = malloc(len + strlen(suffix) + 1);
+    memcpy(output_name, file_name, len);
+    strcpy(output_name + len, suffix);
+    return output_name;
+}
+
+typedef struct Watcher {
+    char** file_names;
+    char** output_names;
+    const CodegenOptions* options;
+    MemPool mem_pool;
+    StrBuf output;
+} Watcher;
+
+// Memory is reused between compilations
+static void recompile_file(size_t index, void* data) {
+    Watcher* watcher = data;
+    const char* file_name = watcher->file_names[index];
+    size_t file_size = 0;
+    char* file_data = read_file(file_name, &file_size);
+    if (!file_data) {
+        fprintf(stderr, "cannot open file '%s'\n", file_name);
+        return;
+    }
+
+    Log log = make_cli_log();
+    watcher->output.size = 0;
+    bool is_changed = false;
+    if (compile_spec_in_pool(&watcher->mem_pool, file_name, file_data, file_size,
+            watcher->options, &watcher->output, &log) &&
+        write_if_changed(watcher->output_names[index], &watcher->output, &is_changed) && is_changed)
+        fprintf(stderr, "%s: updated\n", watcher->output_names[index]);
+    print_cli_log(&log);
+    fflush(stderr);
+    free_log(&log);
+    free(file_data);
+}
+
+static bool watch(char** file_names, size_t file_count, const char* profile_name, CodegenOptions* options) {
+    Log log = make_cli_log();
+    Profile profile = { .prog = NULL };
+    bool ok = !profile_name || load_profile(profile_name, &profile, &log);
+    print_cli_log(&log);
+    free_log(&log);
+    if (ok) {
+        options->profile = profile_name ? &profile : NULL;
+        Watcher watcher = {
+            .file_names = file_names,
+            .output_names = malloc(sizeof(char*) * file_count),
+            .options = options,
+            .mem_pool = new_mem_pool(),
+            .output = make_str_buf()
+        };
+        for (size_t i = 0; i < file_count; ++i) {
+            watcher.output_names[i] = get_output_name(file_names[i], options->target);
+            recompile_file(i, &watcher);
+        }
+        ok = watch_files(file_names, file_count, recompile_file, &watcher);
+        for (size_t i = 0; i < file_count; ++i)
+            free(watcher.output_names[i]);
+        free(watcher.output_names);
+        free_mem_pool(&watcher.mem_pool);
+        free_str_buf(&watcher.output);
+    }
+    free_profile(&profile);
+    return ok;
+}
+
+static bool is_identifier(const char* name) {
+    if (!isalpha((unsigned char)*name) && *name != '_')
+        return false;
+    for (; *name; ++name) {
+        if (!isalnum((unsigned char)*name) && *name != '_')
+            return false;
+    }
+    return true;
+}
+
+static bool parse_target(const char* name, Target* target) {
+    static const struct {
+        const char* name;
+        Target target;
+    } targets[] = {
+        { "c",     TARGET_C },
+        { "cpp",   TARGET_CPP },
+        { "image", TARGET_IMAGE },
+        { "bash",  TARGET_BASH }
+    };
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); ++i) {
+        if (!strcmp(targets[i].name, name)) {
+            *target = targets[i].target;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_error_format(const char* name) {
+    if (!strcmp(name, "text"))
+        json_errors = false;
+    else if (!strcmp(name, "json"))
+        json_errors = true;
+    else
+        return false;
     return true;
 }
 
+static bool parse_count(const char* str, size_t* count) {
+    char* end;
+    unsigned long val = strtoul(str, &end, 10);
+    if (!isdigit((unsigned char)*str) || *end)
+        return false;
+    *count = val;
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: docoptc [options] file.txt...\n"
+        "options:\n"
+        "  -h  --help            Shows this message.\n"
+        "  -s  --syntax          Prints the parsed syntax instead of generating code.\n"
+        "  -r  --response-files  Expands '@file' arguments in the generated parser.\n"
+        "  -e  --embedded        Reads the specification from a block comment of a\n"
+        "                        source file that starts with the '" SPEC_MARKER "'\n"
+        "                        marker, or from the string literals that follow\n"
+        "                        a line comment with the marker.\n"
+        "  -t  --target <name>   Selects the output: 'c' (default), 'cpp' for a C++20\n"
+        "                        header, 'image' for a binary grammar image\n"
+        "                        loaded by the interpreter, or 'bash' for a\n"
+        "                        completion script.\n"
+        "  -i  --instrument      Generates a parser that records a profile.\n"
+        "  -p  --profile <file>  Tests the most frequent usages and options first.\n"
+        "  -Os                   Optimizes the generated parser for size.\n"
+        "  -O3                   Optimizes the generated parser for speed.\n"
+        "      --stats           Reports the size of the generated code.\n"
+        "  -w  --watch           Recompiles the given files whenever they change, to\n"
+        "                        '<file>_args.h' (or '_args.hpp', '.img', '.bash')\n"
+        "                        next to them.\n"
+        "  -m  --module <name>   Combines the given programs in a single C module,\n"
+        "                        named 'multicall' by default, which dispatches\n"
+        "                        them by name.\n"
+        "  -j  --threads <n>     Parses large option sections on n threads.\n"
+        "      --max-errors <n>  Stops after n errors (20 by default, 0 for no limit).\n"
+        "      --error-format <format>\n"
+        "                        Reports errors as 'text' (default) or 'json'.\n");
+}
+
 int main(int argc, char** argv) {
-    if (argc < 2)
+    // File names are moved to the beginning of argv
+    char** file_names = argv;
+    size_t file_count = 0;
+    const char* module = NULL;
+    const char* profile_name = NULL;
+    bool only_syntax = false;
+    bool is_watching = false;
+    CodegenStats stats = { .code_size = 0 };
+    CodegenOptions options = { .target = TARGET_C, .response_files = false };
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage();
+            return 0;
+        } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--syntax"))
+            only_syntax = true;
+        else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--response-files"))
+            options.response_files = true;
+        else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "--watch"))
+            is_watching = true;
+        else if (!strcmp(argv[i], "-e") || !strcmp(argv[i], "--embedded"))
+            options.embedded = true;
+        else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--instrument"))
+            options.instrument = true;
+        else if (!strcmp(argv[i], "--stats"))
+            options.stats = &stats;
+        else if (!strcmp(argv[i], "-Os"))
+            options.opt_level = OPT_SIZE;
+        else if (!strcmp(argv[i], "-O3"))
+            options.opt_level = OPT_SPEED;
+        else if ((!strcmp(argv[i], "-m") || !strcmp(argv[i], "--module")) && i + 1 < argc)
+            module = argv[++i];
+        else if ((!strcmp(argv[i], "-p") || !strcmp(argv[i], "--profile")) && i + 1 < argc)
+            profile_name = argv[++i];
+        else if ((!strcmp(argv[i], "-t") || !strcmp(argv[i], "--target")) && i + 1 < argc) {
+            if (!parse_target(argv[++i], &options.target)) {
+                fprintf(stderr, "unknown target '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--max-errors") && i + 1 < argc) {
+            if (!parse_count(argv[++i], &max_errors)) {
+                fprintf(stderr, "invalid error count '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--threads")) && i + 1 < argc) {
+            if (!parse_count(argv[++i], &options.parse_threads)) {
+                fprintf(stderr, "invalid thread count '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--error-format") && i + 1 < argc) {
+            if (!parse_error_format(argv[++i])) {
+                fprintf(stderr, "unknown error format '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        } else
+            file_names[file_count++] = argv[i];
+    }
+    if (file_count == 0 || (file_count > 1 && only_syntax)) {
+        usage();
+        return 1;
+    }
+    if (file_count > 1 && !module && !is_watching)
+        module = "multicall";
+    if (options.target == TARGET_CPP && options.response_files) {
+        fprintf(stderr, "response files are not supported by the C++ target\n");
+        return 1;
+    }
+    if (options.instrument && (options.target != TARGET_C || profile_name)) {
+        // Profiles refer to usages and options by their position in the specification
+        fprintf(stderr, "instrumentation is only supported by the C target, without a profile\n");
+        return 1;
+    }
+    if ((options.opt_level != OPT_DEFAULT || options.stats) && options.target != TARGET_C) {
+        fprintf(stderr, "optimization levels and statistics are only supported by the C target\n");
+        return 1;
+    }
+    if (module && (options.target != TARGET_C || options.instrument || profile_name || only_syntax)) {
+        fprintf(stderr, "modules are only supported by the C target, without profiles\n");
+        return 1;
+    }
+    if (is_watching && (module || only_syntax || options.stats)) {
+        fprintf(stderr, "watching files is not supported with modules, syntax or statistics\n");
+        return 1;
+    }
+    if (is_watching)
+        return watch(file_names, file_count, profile_name, &options) ? 0 : 1;
+    if (module && !is_identifier(module)) {
+        fprintf(stderr, "invalid module name '%s'\n", module);
         return 1;
-    compile_file(argv[1]);
-    return 0;
+    }
+    if (module)
+        return compile_files(module, file_names, file_count, &options) ? 0 : 1;
+    return compile_file(file_names[0], profile_name, only_syntax, &options) ? 0 : 1;
 }
@@ -35,6 +35,21 @@ void free_mem_pool(MemPool* mem_pool) {
     }
 }
 
+void reset_mem_pool(MemPool* mem_pool) {
+    for (MemBlock* cur = mem_pool->first; cur; cur = cur->next)
+        cur->size = 0;
+    mem_pool->cur = mem_pool->first;
+}
+
+void merge_mem_pool(MemPool* mem_pool, MemPool* other) {
+    MemBlock* last = other->first;
+    while (last->next)
+        last = last->next;
+    last->next = mem_pool->cur->next;
+    mem_pool->cur->next = other->first;
+    other->first = other->cur = NULL;
+}
+
 static inline size_t round_up(size_t num, size_t denom) {
     size_t mod = num % denom;
     return mod != 0 ? num + denom - mod : num;
@@ -12,6 +12,11 @@ typedef struct MemPool {
 
 MemPool new_mem_pool(void);
 void free_mem_pool(MemPool*);
+// Frees all allocations at once, but keeps the blocks for later allocations
+void reset_mem_pool(MemPool*);
+// Moves the blocks of another pool, whose allocations then live as long as
+// those of the first one
+void merge_mem_pool(MemPool*, MemPool* other);
 void* mem_pool_alloc(MemPool*, size_t size, size_t align);
 
 #endif
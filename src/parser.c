@@ -4,21 +4,34 @@
 #include "mem_pool.h"
 #include "str_buf.h"
 #include "utils.h"
+#include "log.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdalign.h>
 #include <assert.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define HAS_THREADS
+#endif
+
+// Minimum size of the option description chunks parsed on separate threads
+#define MIN_CHUNK_SIZE (32 * 1024)
+// Maximum nesting of groups, since all passes over usages are recursive
+#define MAX_DEPTH 256
+
 static inline void skip_token(Parser* parser) {
     parser->prev_end = parser->ahead.range.end;
     parser->ahead = lex(parser->lexer);
 }
 
-Parser make_parser(MemPool* mem_pool, Lexer* lexer) {
+Parser make_parser(MemPool* mem_pool, Lexer* lexer, Log* log) {
     Parser parser = {
         .mem_pool = mem_pool,
-        .lexer = lexer
+        .lexer = lexer,
+        .log = log
     };
     skip_token(&parser);
     return parser;
@@ -32,25 +45,72 @@ static inline char* extract_str(MemPool* mem_pool, const char* file_data, size_t
     return str;
 }
 
-static inline const char* extract_default_val(MemPool* mem_pool, const char* info, const SourceRange* range) {
-    const char* default_begin = strstr(info, "[default:");
-    if (!default_begin)
+static inline const char* extract_bracket_val(MemPool* mem_pool, Log* log, const char* info, const char* key, const SourceRange* range) {
+    const char* val_begin = strstr(info, key);
+    if (!val_begin)
         return NULL;
-    default_begin += 9;
-    default_begin += strspn(default_begin, " \t");
-    const char* default_end = strchr(default_begin, ']');
-    if (!default_end)
+    val_begin += strlen(key);
+    val_begin += strspn(val_begin, " \t");
+    const char* val_end = strchr(val_begin, ']');
+    if (!val_end)
     {
-        default_end = strpbrk(default_begin, " \t");
-        if (!default_end)
-            default_end = default_begin + strlen(default_begin);
-        error_at(range, "unterminated default value specifier");
+        val_end = strpbrk(val_begin, " \t");
+        if (!val_end)
+            val_end = val_begin + strlen(val_begin);
+        error_at(log, range, "unterminated '%s' specifier", key);
+    }
+    size_t len = val_end - val_begin;
+    char* val = mem_pool_alloc(mem_pool, len + 1, alignof(char));
+    memcpy(val, val_begin, len);
+    val[len] = 0;
+    return val;
+}
+
+static inline const char** split_choices(MemPool* mem_pool, const char* str, size_t* count) {
+    static const char* seps = " \t,|";
+    *count = 0;
+    for (const char* ptr = str + strspn(str, seps); *ptr; ptr += strspn(ptr, seps)) {
+        ptr += strcspn(ptr, seps);
+        (*count)++;
+    }
+    const char** choices = mem_pool_alloc(mem_pool, sizeof(char*) * *count, alignof(char*));
+    size_t i = 0;
+    for (const char* ptr = str + strspn(str, seps); *ptr; ptr += strspn(ptr, seps)) {
+        size_t len = strcspn(ptr, seps);
+        choices[i++] = extract_str(mem_pool, ptr, 0, len);
+        ptr += len;
+    }
+    return choices;
+}
+
+static inline ArgType infer_arg_type(const char* default_val) {
+    if (!default_val)
+        return ARG_TYPE_STRING;
+    if (is_int_literal(default_val))
+        return ARG_TYPE_INT;
+    if (is_float_literal(default_val))
+        return ARG_TYPE_FLOAT;
+    if (!strcmp(default_val, "true") || !strcmp(default_val, "false"))
+        return ARG_TYPE_BOOL;
+    return ARG_TYPE_STRING;
+}
+
+// The type is only inferred for options that take an argument, so that a
+// misplaced default value is reported on its own by the checker.
+static inline ArgType extract_arg_type(Log* log, const char* type_name, const char* default_val, bool has_arg, bool has_choices, const SourceRange* range) {
+    if (has_choices) {
+        if (type_name)
+            error_at(log, range, "type specifier cannot be combined with a list of choices");
+        return ARG_TYPE_CHOICE;
     }
-    size_t len = default_end - default_begin;
-    char* default_val = mem_pool_alloc(mem_pool, len + 1, alignof(char));
-    memcpy(default_val, default_begin, len);
-    default_val[len] = 0;
-    return default_val;
+    if (!type_name)
+        return has_arg ? infer_arg_type(default_val) : ARG_TYPE_STRING;
+    for (ArgType type = ARG_TYPE_STRING; type < ARG_TYPE_CHOICE; ++type) {
+        if (!strcmp(type_name, get_arg_type_name(type)))
+            return type;
+    }
+    error_at(log, range, "unknown argument type '%s'", type_name);
+    return ARG_TYPE_STRING;
 }
 
 static inline Syntax* make_syntax(Parser* parser, const SourcePos* begin, const Syntax* syntax) {
@@ -70,17 +130,24 @@ static inline bool accept_token(Parser* parser, TokenTag tag) {
     return false;
 }
 
+// Recovers at the end of the line, without reporting the errors that follow on
+// the same line, since they are usually caused by the first one.
 static inline void error_on_token(Parser* parser, const char* context) {
-    if (parser->ahead.tag == TOKEN_NL || parser->ahead.tag == TOKEN_END) {
-        error_at(&parser->ahead.range, "expected %s, but got %s",
-            context, get_token_tag_name(parser->ahead.tag));
-    } else {
-        error_at(&parser->ahead.range, "expected %s, but got '%.*s'",
-            context,
-            get_source_range_len(&parser->ahead.range),
-            get_source_range_str(&parser->ahead.range, parser->lexer->file_data));
+    bool is_line_end = parser->ahead.tag == TOKEN_NL || parser->ahead.tag == TOKEN_END;
+    if (parser->ahead.range.begin.row != parser->error_row) {
+        parser->error_row = parser->ahead.range.begin.row;
+        if (is_line_end) {
+            error_at(parser->log, &parser->ahead.range, "expected %s, but got %s",
+                context, get_token_tag_name(parser->ahead.tag));
+        } else {
+            error_at(parser->log, &parser->ahead.range, "expected %s, but got '%.*s'",
+                context,
+                get_source_range_len(&parser->ahead.range),
+                get_source_range_str(&parser->ahead.range, parser->lexer->file_data));
+        }
     }
-    skip_token(parser);
+    if (!is_line_end)
+        skip_token(parser);
 }
 
 static inline bool expect_token(Parser* parser, TokenTag tag) {
@@ -99,7 +166,6 @@ static inline void eat_token(Parser* parser, TokenTag tag) {
 static Syntax* parse_error(Parser* parser, const char* context) {
     SourcePos begin = parser->ahead.range.begin;
     error_on_token(parser, context);
-    skip_token(parser);
     return make_syntax(parser, &begin, &(Syntax) { .tag = SYNTAX_ERROR });
 }
 
@@ -119,7 +185,14 @@ static const char* parse_ident(Parser* parser) {
 static Syntax* parse_many(Parser* parser, TokenTag stop, Syntax* (*parse_one)(Parser*)) {
     Syntax* first = NULL;
     Syntax** prev = &first;
-    while (parser->ahead.tag != stop) {
+    // Groups cannot span several lines, which also guarantees termination on unbalanced input.
+    // Parsing stops early once the log cannot record more errors.
+    while (
+        parser->ahead.tag != stop &&
+        parser->ahead.tag != TOKEN_NL &&
+        parser->ahead.tag != TOKEN_END &&
+        !is_log_full(parser->log))
+    {
         Syntax* next = parse_one(parser);
         *prev = next;
         prev = &next->next;
@@ -158,6 +231,13 @@ static Syntax* parse_opt(Parser* parser) {
     });
 }
 
+static Syntax* parse_special(Parser* parser) {
+    SourcePos begin = parser->ahead.range.begin;
+    SyntaxTag tag = parser->ahead.tag == TOKEN_DASH ? SYNTAX_STDIN : SYNTAX_SEP;
+    skip_token(parser);
+    return make_syntax(parser, &begin, &(Syntax) { .tag = tag });
+}
+
 static Syntax* parse_command(Parser* parser) {
     SourcePos begin = parser->ahead.range.begin;
     const char* name = extract_token_str(parser, 0, 0);
@@ -165,18 +245,38 @@ static Syntax* parse_command(Parser* parser) {
     return make_syntax(parser, &begin, &(Syntax) { .tag = SYNTAX_COMMAND, .command.name = name });
 }
 
+// Skips the rest of the line
+static Syntax* parse_deep_group(Parser* parser) {
+    SourcePos begin = parser->ahead.range.begin;
+    if (parser->ahead.range.begin.row != parser->error_row) {
+        parser->error_row = parser->ahead.range.begin.row;
+        error_at(parser->log, &parser->ahead.range, "groups cannot be nested more than %d levels deep", MAX_DEPTH);
+    }
+    skip_line(parser->lexer);
+    skip_token(parser);
+    return make_syntax(parser, &begin, &(Syntax) { .tag = SYNTAX_ERROR });
+}
+
 static Syntax* parse_parens(Parser* parser) {
+    if (parser->depth >= MAX_DEPTH)
+        return parse_deep_group(parser);
     SourcePos begin = parser->ahead.range.begin;
     eat_token(parser, TOKEN_LPAREN);
+    parser->depth++;
     Syntax* elems = parse_many(parser, TOKEN_RPAREN, parse_or);
+    parser->depth--;
     expect_token(parser, TOKEN_RPAREN);
     return make_syntax(parser, &begin, &(Syntax) { .tag = SYNTAX_PARENS, .parens.elems = elems });
 }
 
 static Syntax* parse_brackets(Parser* parser) {
+    if (parser->depth >= MAX_DEPTH)
+        return parse_deep_group(parser);
     SourcePos begin = parser->ahead.range.begin;
     eat_token(parser, TOKEN_LBRACKET);
+    parser->depth++;
     Syntax* elems = parse_many(parser, TOKEN_RBRACKET, parse_or);
+    parser->depth--;
     expect_token(parser, TOKEN_RBRACKET);
     return make_syntax(parser, &begin, &(Syntax) { .tag = SYNTAX_BRACKETS, .brackets.elems = elems });
 }
@@ -184,7 +284,7 @@ static Syntax* parse_brackets(Parser* parser) {
 static Syntax* parse_elem(Parser* parser) {
     switch (parser->ahead.tag) {
         case TOKEN_DASH:     // fallthrough
-        case TOKEN_DDASH:    // fallthrough
+        case TOKEN_DDASH:    return parse_special(parser);
         case TOKEN_IDENT:    return parse_command(parser);
         case TOKEN_SOPT:     // fallthrough
         case TOKEN_LOPT:     return parse_opt(parser);
@@ -279,13 +379,23 @@ static Syntax* parse_desc(Parser* parser) {
     const char* info = parse_desc_info(parser);
     info_range.end = parser->prev_end;
 
-    const char* default_val = extract_default_val(parser->mem_pool, info, &info_range);
+    const char* default_val = extract_bracket_val(parser->mem_pool, parser->log, info, "[default:", &info_range);
+    const char* type_name = extract_bracket_val(parser->mem_pool, parser->log, info, "[type:", &info_range);
+    const char* choices_str = extract_bracket_val(parser->mem_pool, parser->log, info, "[choices:", &info_range);
+
+    size_t choice_count = 0;
+    const char** choices = choices_str ? split_choices(parser->mem_pool, choices_str, &choice_count) : NULL;
+    bool has_arg = first_opt->option.arg || (first_opt->next && first_opt->next->option.arg);
+    ArgType arg_type = extract_arg_type(parser->log, type_name, default_val, has_arg, choices != NULL, &info_range);
 
     return make_syntax(parser, &begin, &(Syntax) {
         .tag = SYNTAX_DESC,
         .desc = {
             .info = info,
             .default_val = default_val,
+            .arg_type = arg_type,
+            .choices = choices,
+            .choice_count = choice_count,
             .elems = first_opt
         }
     });
@@ -294,7 +404,7 @@ static Syntax* parse_desc(Parser* parser) {
 static Syntax* parse_descs(Parser* parser) {
     Syntax* first_desc = NULL;
     Syntax** prev_desc = &first_desc;
-    while (parser->ahead.tag != TOKEN_END) {
+    while (parser->ahead.tag != TOKEN_END && !is_log_full(parser->log)) {
         while (accept_token(parser, TOKEN_NL));
         if (parser->ahead.tag == TOKEN_LOPT || parser->ahead.tag == TOKEN_SOPT) {
             *prev_desc = parse_desc(parser);
@@ -307,6 +417,123 @@ static Syntax* parse_descs(Parser* parser) {
     return first_desc;
 }
 
+#ifdef HAS_THREADS
+// Option descriptions start at lines whose first token is an option, and do
+// not span such lines. The option section can thus be split at these lines,
+// and the chunks parsed independently, with their own memory pool and log.
+typedef struct DescChunk {
+    const Lexer* lexer;
+    SourceRange range;
+    MemPool mem_pool;
+    Log log;
+    Parser parser;
+    Syntax* descs;
+    pthread_t thread;
+    bool has_thread;
+} DescChunk;
+
+static void* parse_desc_chunk(void* data) {
+    DescChunk* chunk = data;
+    Lexer lexer = make_range_lexer(chunk->lexer->file_data, &chunk->range);
+    chunk->parser = make_parser(&chunk->mem_pool, &lexer, &chunk->log);
+    chunk->descs = parse_descs(&chunk->parser);
+    chunk->parser.lexer = NULL;
+    return NULL;
+}
+
+// Returns the first option starting a line at or after the given position,
+// or the end of the file
+static SourcePos find_desc_begin(const Lexer* lexer, SourcePos pos) {
+    const char* data = lexer->file_data;
+    while (pos.bytes < lexer->file_size) {
+        const char* line_end = memchr(data + pos.bytes, '\n', lexer->file_size - pos.bytes);
+        if (!line_end)
+            break;
+        pos = (SourcePos) { .row = pos.row + 1, .col = 1, .bytes = line_end - data + 1 };
+
+        Lexer line_lexer = *lexer;
+        line_lexer.pos = pos;
+        Token token = lex(&line_lexer);
+        if (token.tag == TOKEN_SOPT || token.tag == TOKEN_LOPT)
+            return token.range.begin;
+    }
+    return (SourcePos) { .bytes = lexer->file_size };
+}
+
+// Counts lines up to the given offset, so that positions in the chunks are
+// relative to the whole file
+static SourcePos advance_pos(const Lexer* lexer, SourcePos pos, size_t bytes) {
+    const char* data = lexer->file_data;
+    const char* line_end;
+    while ((line_end = memchr(data + pos.bytes, '\n', bytes - pos.bytes))) {
+        pos.row++;
+        pos.col = 1;
+        pos.bytes = line_end - data + 1;
+    }
+    pos.col += bytes - pos.bytes;
+    pos.bytes = bytes;
+    return pos;
+}
+
+static Syntax* parse_descs_in_parallel(Parser* parser, size_t chunk_count) {
+    const Lexer* lexer = parser->lexer;
+    DescChunk* chunks = calloc(chunk_count, sizeof(DescChunk));
+    SourcePos begin = parser->ahead.range.begin;
+    size_t size = lexer->file_size - begin.bytes;
+
+    size_t count = 0;
+    for (SourcePos pos = begin; pos.bytes < lexer->file_size && count < chunk_count; ++count) {
+        chunks[count].lexer = lexer;
+        chunks[count].range = (SourceRange) { .file_name = lexer->file_name, .begin = pos };
+        size_t split = begin.bytes + size / chunk_count * (count + 1);
+        if (count + 1 == chunk_count)
+            pos.bytes = lexer->file_size;
+        else
+            pos = find_desc_begin(lexer, split > pos.bytes ? advance_pos(lexer, pos, split) : pos);
+        chunks[count].range.end = pos;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].mem_pool = new_mem_pool();
+        chunks[i].log = make_log();
+        chunks[i].log.max_count = parser->log->max_count;
+        if (i > 0)
+            chunks[i].has_thread = pthread_create(&chunks[i].thread, NULL, parse_desc_chunk, &chunks[i]) == 0;
+    }
+
+    Syntax* first_desc = NULL;
+    Syntax** prev_desc = &first_desc;
+    for (size_t i = 0; i < count; ++i) {
+        // The first chunk is parsed on the calling thread, as are those for
+        // which no thread could be created
+        if (chunks[i].has_thread)
+            pthread_join(chunks[i].thread, NULL);
+        else
+            parse_desc_chunk(&chunks[i]);
+        *prev_desc = chunks[i].descs;
+        while (*prev_desc)
+            prev_desc = &(*prev_desc)->next;
+        merge_mem_pool(parser->mem_pool, &chunks[i].mem_pool);
+        merge_log(parser->log, &chunks[i].log);
+    }
+    parser->prev_end = chunks[count - 1].parser.prev_end;
+    parser->ahead = chunks[count - 1].parser.ahead;
+    free(chunks);
+    return first_desc;
+}
+#endif
+
+static Syntax* parse_descs_in_chunks(Parser* parser) {
+#ifdef HAS_THREADS
+    size_t size = parser->lexer->file_size - parser->ahead.range.begin.bytes;
+    size_t chunk_count = size / MIN_CHUNK_SIZE;
+    if (chunk_count > parser->thread_count)
+        chunk_count = parser->thread_count;
+    if (chunk_count > 1)
+        return parse_descs_in_parallel(parser, chunk_count);
+#endif
+    return parse_descs(parser);
+}
+
 static bool locate_usage(Parser* parser, SourcePos* end) {
     while (true) {
         *end = parser->ahead.range.begin;
@@ -333,7 +560,7 @@ Syntax* parse(Parser* parser) {
         parser->lexer->file_data, begin.bytes, info_end.bytes);
 
     Syntax* usages = parse_many(parser, TOKEN_NL, parse_usage);
-    Syntax* descs = parse_descs(parser);
+    Syntax* descs = parse_descs_in_chunks(parser);
 
     return make_syntax(parser, &begin, &(Syntax) {
         .tag = SYNTAX_ROOT,
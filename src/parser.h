@@ -6,15 +6,23 @@
 typedef struct Syntax  Syntax;
 typedef struct MemPool MemPool;
 typedef struct Lexer   Lexer;
+typedef struct Log     Log;
 
 typedef struct Parser {
     Lexer* lexer;
     MemPool* mem_pool;
+    Log* log;
     SourcePos prev_end;
     Token ahead;
+    // Row of the last syntax error, or 0 if none
+    uint32_t error_row;
+    // Number of groups being parsed
+    size_t depth;
+    // Large option sections are parsed on up to this many threads
+    size_t thread_count;
 } Parser;
 
-Parser make_parser(MemPool*, Lexer*);
+Parser make_parser(MemPool*, Lexer*, Log*);
 Syntax* parse(Parser*);
 
 #endif
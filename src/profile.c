@@ -0,0 +1,346 @@
+#include "profile.h"
+#include "grammar.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_WORD_LEN 64
+#define MAX_LEADING_COMMANDS 16
+
+typedef struct ProfileReader {
+    const char* file_name;
+    const char* begin;
+    const char* ptr;
+    const char* end;
+    uint32_t row;
+    Log* log;
+} ProfileReader;
+
+static void profile_error(ProfileReader* reader, const char* msg) {
+    SourcePos pos = { .row = reader->row, .col = 1, .bytes = reader->ptr - reader->begin };
+    error_at(reader->log, &(SourceRange) { .file_name = reader->file_name, .begin = pos, .end = pos }, "%s", msg);
+}
+
+static bool read_word(ProfileReader* reader, char* word) {
+    while (reader->ptr != reader->end && (*reader->ptr == ' ' || *reader->ptr == '\t'))
+        reader->ptr++;
+    size_t len = 0;
+    while (reader->ptr != reader->end && !isspace((unsigned char)*reader->ptr)) {
+        if (len + 1 >= MAX_WORD_LEN)
+            return false;
+        word[len++] = *(reader->ptr++);
+    }
+    word[len] = 0;
+    return len > 0;
+}
+
+static bool read_number(ProfileReader* reader, uint64_t* val) {
+    char word[MAX_WORD_LEN];
+    char* end;
+    if (!read_word(reader, word) || !isdigit((unsigned char)word[0]))
+        return false;
+    *val = strtoull(word, &end, 10);
+    return *end == 0;
+}
+
+static bool skip_line(ProfileReader* reader) {
+    while (reader->ptr != reader->end && (*reader->ptr == ' ' || *reader->ptr == '\t' || *reader->ptr == '\r'))
+        reader->ptr++;
+    if (reader->ptr != reader->end && *reader->ptr != '\n')
+        return false;
+    if (reader->ptr != reader->end)
+        reader->ptr++;
+    reader->row++;
+    return true;
+}
+
+static bool add_entry(Profile* profile, ProfileEntry entry) {
+    if (profile->entry_count == profile->entry_cap) {
+        size_t cap = profile->entry_cap ? profile->entry_cap * 2 : 16;
+        ProfileEntry* entries = realloc(profile->entries, sizeof(ProfileEntry) * cap);
+        if (!entries)
+            return false;
+        profile->entries = entries;
+        profile->entry_cap = cap;
+    }
+    profile->entries[profile->entry_count++] = entry;
+    return true;
+}
+
+static bool read_entry(ProfileReader* reader, Profile* profile) {
+    char kind[MAX_WORD_LEN];
+    uint64_t index, count;
+    if (!read_word(reader, kind)) {
+        // Empty lines are ignored
+        return skip_line(reader);
+    }
+    if (!read_number(reader, &index) || !read_number(reader, &count))
+        return false;
+    bool is_usage = !strcmp(kind, "usage");
+    if (!is_usage && strcmp(kind, "option"))
+        return false;
+    if (index >= (is_usage ? profile->usage_count : profile->option_count))
+        return false;
+    return add_entry(profile, (ProfileEntry) { is_usage, index, count }) && skip_line(reader);
+}
+
+bool parse_profile(const char* file_name, const char* data, size_t size, Profile* profile, Log* log) {
+    ProfileReader reader = {
+        .file_name = file_name,
+        .begin = data,
+        .ptr = data,
+        .end = data + size,
+        .row = 1,
+        .log = log
+    };
+    memset(profile, 0, sizeof(Profile));
+    profile->file_name = file_name;
+
+    char magic[MAX_WORD_LEN], prog[MAX_WORD_LEN];
+    if (!read_word(&reader, magic) || strcmp(magic, "docopt-profile") ||
+        !read_word(&reader, prog) ||
+        !read_number(&reader, &profile->usage_count) ||
+        !read_number(&reader, &profile->option_count) ||
+        !skip_line(&reader))
+    {
+        profile_error(&reader, "invalid profile header");
+        return false;
+    }
+
+    profile->prog = malloc(strlen(prog) + 1);
+    strcpy(profile->prog, prog);
+    while (reader.ptr != reader.end) {
+        if (!read_entry(&reader, profile)) {
+            profile_error(&reader, "invalid profile entry");
+            free_profile(profile);
+            return false;
+        }
+    }
+    return true;
+}
+
+void free_profile(Profile* profile) {
+    free(profile->prog);
+    free(profile->entries);
+    memset(profile, 0, sizeof(Profile));
+}
+
+typedef struct RankedItem {
+    uint64_t count;
+    size_t index;
+} RankedItem;
+
+// Sorts by decreasing count, and keeps the original order of equal counts
+static int compare_ranked_items(const void* first, const void* second) {
+    const RankedItem* first_item = first;
+    const RankedItem* second_item = second;
+    if (first_item->count != second_item->count)
+        return first_item->count > second_item->count ? -1 : 1;
+    return first_item->index < second_item->index ? -1 : first_item->index > second_item->index;
+}
+
+static void reorder_options(Grammar* grammar, const uint64_t* counts) {
+    RankedItem* items = malloc(sizeof(RankedItem) * (grammar->option_count + 1));
+    size_t* new_index = malloc(sizeof(size_t) * (grammar->option_count + 1));
+    Option* options = malloc(sizeof(Option) * (grammar->option_count + 1));
+
+    for (size_t i = 0; i < grammar->option_count; ++i)
+        items[i] = (RankedItem) { counts[i], i };
+    qsort(items, grammar->option_count, sizeof(RankedItem), compare_ranked_items);
+    for (size_t i = 0; i < grammar->option_count; ++i) {
+        options[i] = grammar->options[items[i].index];
+        new_index[items[i].index] = i;
+    }
+    memcpy(grammar->options, options, sizeof(Option) * grammar->option_count);
+    for (size_t i = 0; i < grammar->node_count; ++i) {
+        if (grammar->nodes[i].tag == NODE_OPTION)
+            grammar->nodes[i].index = new_index[grammar->nodes[i].index];
+    }
+
+    free(items);
+    free(new_index);
+    free(options);
+}
+
+// Usages are tried in order, and the first one that matches wins. A usage can
+// therefore only move ahead of the usages it is disjoint from, which require a
+// different command at the same position. Only the commands that lead a usage,
+// before any argument, optional or repeated element, are compared: usages are
+// bucketed by their first command, then by their second one, and so on. Within
+// a bucket, usages whose commands stop at that depth conflict with all others,
+// and split the bucket in segments that keep their order. The sub-buckets of a
+// segment are disjoint, and are merged by frequency once each is sorted.
+typedef struct UsageGroup {
+    size_t* begin;
+    size_t* end;
+} UsageGroup;
+
+typedef struct UsageSorter {
+    const uint64_t* counts;
+    // Leading commands of each usage, MAX_LEADING_COMMANDS per usage
+    uint32_t* commands;
+    size_t* command_counts;
+    // Usages being sorted, and scratch space of the same size
+    size_t* order;
+    size_t* tmp;
+    UsageGroup* groups;
+    // Scratch counters, indexed by positional and left zeroed
+    size_t* bucket_sizes;
+    size_t* bucket_offsets;
+} UsageSorter;
+
+static size_t get_leading_commands(const Grammar* grammar, size_t usage, uint32_t* commands) {
+    size_t count = 0;
+    size_t end = usage + grammar->nodes[usage].size;
+    for (size_t i = usage + 1; i < end && count < MAX_LEADING_COMMANDS; ++i) {
+        const Node* node = &grammar->nodes[i];
+        if (node->tag == NODE_COMMAND)
+            commands[count++] = node->index;
+        else if (node->tag != NODE_SEQ && node->tag != NODE_OPTION && node->tag != NODE_ANY_OPTIONS)
+            break;
+    }
+    return count;
+}
+
+static inline uint32_t get_command(const UsageSorter* sorter, size_t usage, size_t depth) {
+    return sorter->commands[usage * MAX_LEADING_COMMANDS + depth];
+}
+
+static inline bool is_more_frequent(const UsageSorter* sorter, size_t first, size_t second) {
+    uint64_t first_count = sorter->counts[first], second_count = sorter->counts[second];
+    return first_count > second_count || (first_count == second_count && first < second);
+}
+
+static void sift_down(const UsageSorter* sorter, UsageGroup* heap, size_t count, size_t i) {
+    while (true) {
+        size_t best = i;
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < count; ++child) {
+            if (is_more_frequent(sorter, *heap[child].begin, *heap[best].begin))
+                best = child;
+        }
+        if (best == i)
+            return;
+        UsageGroup group = heap[i];
+        heap[i] = heap[best];
+        heap[best] = group;
+        i = best;
+    }
+}
+
+static void sort_usages(UsageSorter* sorter, size_t* usages, size_t count, size_t depth);
+
+// Sorts usages that all have a command at the given depth
+static void sort_segment(UsageSorter* sorter, size_t* usages, size_t count, size_t depth) {
+    size_t* tmp = sorter->tmp + (usages - sorter->order);
+    UsageGroup* groups = sorter->groups + (usages - sorter->order);
+
+    // Stable bucket sort by command, touching only the buckets in use
+    for (size_t i = 0; i < count; ++i)
+        sorter->bucket_sizes[get_command(sorter, usages[i], depth)]++;
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t command = get_command(sorter, usages[i], depth);
+        if (sorter->bucket_sizes[command] > 0) {
+            sorter->bucket_offsets[command] = offset;
+            offset += sorter->bucket_sizes[command];
+            sorter->bucket_sizes[command] = 0;
+        }
+    }
+    for (size_t i = 0; i < count; ++i)
+        tmp[sorter->bucket_offsets[get_command(sorter, usages[i], depth)]++] = usages[i];
+    memcpy(usages, tmp, sizeof(size_t) * count);
+
+    size_t group_count = 0;
+    for (size_t begin = 0, end; begin < count; begin = end) {
+        uint32_t command = get_command(sorter, usages[begin], depth);
+        for (end = begin + 1; end < count && get_command(sorter, usages[end], depth) == command; ++end);
+        sort_usages(sorter, usages + begin, end - begin, depth + 1);
+        groups[group_count++] = (UsageGroup) { usages + begin, usages + end };
+    }
+    if (group_count == 1)
+        return;
+
+    for (size_t i = group_count / 2; i-- > 0;)
+        sift_down(sorter, groups, group_count, i);
+    for (size_t i = 0; i < count; ++i) {
+        tmp[i] = *groups[0].begin++;
+        if (groups[0].begin == groups[0].end)
+            groups[0] = groups[--group_count];
+        sift_down(sorter, groups, group_count, 0);
+    }
+    memcpy(usages, tmp, sizeof(size_t) * count);
+}
+
+// Sorts usages that are given in their original order, and share the commands
+// before the given depth
+static void sort_usages(UsageSorter* sorter, size_t* usages, size_t count, size_t depth) {
+    for (size_t begin = 0, end; begin < count; begin = end + 1) {
+        for (end = begin; end < count && sorter->command_counts[usages[end]] > depth; ++end);
+        if (end - begin > 1)
+            sort_segment(sorter, usages + begin, end - begin, depth);
+    }
+}
+
+static void reorder_usages(Grammar* grammar, const uint64_t* counts) {
+    size_t usage_count = grammar->usage_count;
+    UsageSorter sorter = {
+        .counts = counts,
+        .commands = malloc(sizeof(uint32_t) * MAX_LEADING_COMMANDS * (usage_count + 1)),
+        .command_counts = malloc(sizeof(size_t) * (usage_count + 1)),
+        .order = malloc(sizeof(size_t) * (usage_count + 1)),
+        .tmp = malloc(sizeof(size_t) * (usage_count + 1)),
+        .groups = malloc(sizeof(UsageGroup) * (usage_count + 1)),
+        .bucket_sizes = calloc(grammar->positional_count + 1, sizeof(size_t)),
+        .bucket_offsets = malloc(sizeof(size_t) * (grammar->positional_count + 1))
+    };
+    for (size_t i = 0; i < usage_count; ++i) {
+        sorter.command_counts[i] = get_leading_commands(grammar, grammar->usages[i], &sorter.commands[i * MAX_LEADING_COMMANDS]);
+        sorter.order[i] = i;
+    }
+    sort_usages(&sorter, sorter.order, usage_count, 0);
+    for (size_t i = 0; i < usage_count; ++i)
+        sorter.tmp[i] = grammar->usages[sorter.order[i]];
+    memcpy(grammar->usages, sorter.tmp, sizeof(size_t) * usage_count);
+
+    free(sorter.commands);
+    free(sorter.command_counts);
+    free(sorter.order);
+    free(sorter.tmp);
+    free(sorter.groups);
+    free(sorter.bucket_sizes);
+    free(sorter.bucket_offsets);
+}
+
+static void report_profile_error(const Profile* profile, Log* log, const char* msg, const char* prog) {
+    SourcePos pos = { .row = 1, .col = 1 };
+    error_at(log, &(SourceRange) { .file_name = profile->file_name, .begin = pos, .end = pos }, msg, prog);
+}
+
+bool apply_profile(Grammar* grammar, const Profile* profile, Log* log) {
+    if (strcmp(profile->prog, grammar->prog) ||
+        profile->usage_count != grammar->usage_count ||
+        profile->option_count != grammar->option_count)
+    {
+        report_profile_error(profile, log, "profile does not match the specification of '%s'", grammar->prog);
+        return false;
+    }
+
+    uint64_t* usage_counts = calloc(grammar->usage_count + 1, sizeof(uint64_t));
+    uint64_t* option_counts = calloc(grammar->option_count + 1, sizeof(uint64_t));
+    bool ok = usage_counts && option_counts;
+    if (!ok)
+        report_profile_error(profile, log, "not enough memory to apply the profile of '%s'", grammar->prog);
+    for (size_t i = 0; ok && i < profile->entry_count; ++i) {
+        const ProfileEntry* entry = &profile->entries[i];
+        (entry->is_usage ? usage_counts : option_counts)[entry->index] += entry->count;
+    }
+    if (ok) {
+        reorder_options(grammar, option_counts);
+        reorder_usages(grammar, usage_counts);
+    }
+    free(usage_counts);
+    free(option_counts);
+    return ok;
+}
@@ -0,0 +1,39 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Profiles are written by instrumented parsers (generated with '--instrument'),
+// and record how often each usage and each option matched. They are used to
+// reorder the grammar, so that the most frequent invocations are tested first.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct Grammar Grammar;
+typedef struct Log Log;
+
+typedef struct ProfileEntry {
+    bool is_usage;
+    uint64_t index;
+    uint64_t count;
+} ProfileEntry;
+
+// Entries are kept as read, and only summed once the counts of the header have
+// been checked against the grammar.
+typedef struct Profile {
+    const char* file_name;
+    char* prog;
+    uint64_t usage_count;
+    uint64_t option_count;
+    ProfileEntry* entries;
+    size_t entry_count, entry_cap;
+} Profile;
+
+bool parse_profile(const char* file_name, const char* data, size_t size, Profile*, Log*);
+void free_profile(Profile*);
+
+// Reorders options by frequency, and usages by frequency as long as this does
+// not change which usage matches a given command line.
+bool apply_profile(Grammar*, const Profile*, Log*);
+
+#endif
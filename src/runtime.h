@@ -0,0 +1,1184 @@
+// Runtime support for parsers generated by docoptc.
+// This file is embedded verbatim in the generated code, and guarded so that
+// several generated parsers can be included in the same translation unit.
+#ifndef DOCOPTC_RUNTIME_H
+#define DOCOPTC_RUNTIME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define DOCOPT_HAS_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define DOCOPT_FAIL ((size_t)-1)
+
+// Size of the error message buffer in generated result structures
+#define DOCOPT_ERROR_SIZE 128
+
+// Maximum number of positional arguments and options for which the parser
+// uses stack memory instead of allocating its working buffers.
+#define DOCOPT_STACK_SIZE 64
+
+typedef struct DocoptList {
+    const char* const* items;
+    size_t count;
+} DocoptList;
+
+enum {
+    DOCOPT_OK,
+    DOCOPT_ERROR
+};
+
+enum {
+    DOCOPT_NODE_COMMAND,
+    DOCOPT_NODE_ARG,
+    DOCOPT_NODE_OPTION,
+    DOCOPT_NODE_SEQ,
+    DOCOPT_NODE_OPTIONAL,
+    DOCOPT_NODE_OR,
+    DOCOPT_NODE_REPEAT,
+    DOCOPT_NODE_ANY_OPTIONS
+};
+
+// Kinds of option fields. Options with a kind greater or equal to
+// DOCOPT_STRING take an argument.
+enum {
+    DOCOPT_FLAG,
+    DOCOPT_COUNT,
+    DOCOPT_STRING,
+    DOCOPT_INT,
+    DOCOPT_FLOAT,
+    DOCOPT_BOOL,
+    DOCOPT_CHOICE
+};
+
+// Kinds of positional fields
+enum {
+    DOCOPT_COMMAND,
+    DOCOPT_COMMAND_COUNT,
+    DOCOPT_ARG,
+    DOCOPT_ARG_LIST
+};
+
+enum {
+    DOCOPT_VALUE_OK,
+    DOCOPT_VALUE_INVALID,
+    DOCOPT_VALUE_RANGE
+};
+
+// Actions for short options, indexed by character in a 256-entry table.
+// Options that take a value consume the rest of the bundle if it is not
+// empty (as in '-ofile'), or the next argument otherwise.
+enum {
+    DOCOPT_SHORT_NONE,
+    DOCOPT_SHORT_FLAG,
+    DOCOPT_SHORT_VALUE
+};
+
+typedef struct DocoptShort {
+    unsigned char action;
+    unsigned option;
+} DocoptShort;
+
+typedef struct DocoptNode {
+    unsigned char tag;
+    unsigned index;
+    unsigned size;
+} DocoptNode;
+
+// Options that appear in no usage can only be given with the '[options]'
+// shortcut
+typedef struct DocoptOption {
+    const char* long_name;
+    char short_name;
+    unsigned char kind;
+    bool is_in_usage;
+    size_t offset;
+    const char* const* choices;
+    size_t choice_count;
+} DocoptOption;
+
+typedef struct DocoptPositional {
+    const char* name;
+    unsigned char kind;
+    size_t offset;
+} DocoptPositional;
+
+// Counters of instrumented parsers, which are written to a profile when the
+// program exits. Instrumented parsers are meant for profiling runs only, and do
+// not synchronize updates to the counters.
+typedef struct DocoptProfile {
+    const char* file_name;
+    unsigned long long* usage_counts;
+    unsigned long long* option_counts;
+    void (*dump)(void);
+    bool is_registered;
+} DocoptProfile;
+
+struct DocoptMatch;
+
+// Parsers generated for speed replace the node and short option tables with
+// specialized code: one matching function per usage, and a long option lookup.
+typedef size_t (*DocoptMatcher)(struct DocoptMatch*, size_t);
+typedef const DocoptOption* (*DocoptFindLong)(const char*, size_t);
+
+typedef struct DocoptSpec {
+    const char* prog;
+    const DocoptOption* options;
+    size_t option_count;
+    const DocoptShort* shorts;
+    const DocoptPositional* positionals;
+    size_t positional_count;
+    const DocoptNode* nodes;
+    const unsigned* usages;
+    size_t usage_count;
+    bool response_files;
+    DocoptProfile* profile;
+    const DocoptMatcher* matchers;
+    DocoptFindLong find_long;
+    // Help and version options, which end parsing as soon as they are given
+    const unsigned* exit_options;
+    size_t exit_option_count;
+    // Set when a usage matches an empty command line, and to the argument of a
+    // usage such as 'prog <file>' when it is the first one that can match a
+    // single argument.
+    bool accepts_empty;
+    const DocoptPositional* single_arg;
+} DocoptSpec;
+
+// Memory owned by a result structure: allocations, and mapped response files
+typedef struct DocoptMem {
+    struct DocoptMem* next;
+    void* map;
+    size_t map_size;
+    char data[];
+} DocoptMem;
+
+// Per-call parsing state. Generated parsers do not use any global state.
+typedef struct DocoptContext {
+    const DocoptSpec* spec;
+    void* args;
+    DocoptMem** mem;
+    char* error;
+    char* const* tokens;
+} DocoptContext;
+
+// Positional argument, along with its index in the token array (or -1 when it
+// comes from a response file), and the positional field it is matched with.
+typedef struct DocoptPos {
+    const char* str;
+    int index;
+    unsigned slot;
+} DocoptPos;
+
+// Options consumed by the usage being matched are marked in `used`, and listed
+// in `used_options`, so that the marks of failed alternatives can be undone. The
+// '[options]' shortcut is marked as an extra option, after the others.
+typedef struct DocoptMatch {
+    const DocoptSpec* spec;
+    DocoptPos* pos;
+    size_t pos_count;
+    size_t pos_cap;
+    bool is_pos_on_heap;
+    const bool* given;
+    size_t given_count;
+    bool* used;
+    unsigned* used_options;
+    size_t used_count;
+} DocoptMatch;
+
+// Position in the token array, and in the response file being read, if any
+typedef struct DocoptCursor {
+    int index;
+    int count;
+    char* file_pos;
+    char* file_end;
+} DocoptCursor;
+
+static inline int docopt_error(const DocoptContext* context, const char* format_str, ...) {
+    va_list args;
+    va_start(args, format_str);
+    vsnprintf(context->error, DOCOPT_ERROR_SIZE, format_str, args);
+    va_end(args);
+    return DOCOPT_ERROR;
+}
+
+static inline void* docopt_alloc(const DocoptContext* context, size_t size) {
+    DocoptMem* mem = malloc(sizeof(DocoptMem) + size);
+    if (!mem)
+        return NULL;
+    mem->next = *context->mem;
+    mem->map = NULL;
+    mem->map_size = 0;
+    *context->mem = mem;
+    return mem->data;
+}
+
+static inline void docopt_free(DocoptMem* mem) {
+    while (mem) {
+        DocoptMem* next = mem->next;
+#ifdef DOCOPT_HAS_MMAP
+        if (mem->map)
+            munmap(mem->map, mem->map_size);
+#endif
+        free(mem);
+        mem = next;
+    }
+}
+
+static inline int docopt_parse_int(const char* str, long long* val) {
+    bool is_neg = *str == '-';
+    str += *str == '-' || *str == '+';
+    if (*str == 0)
+        return DOCOPT_VALUE_INVALID;
+    unsigned long long limit = is_neg ? (unsigned long long)LLONG_MAX + 1 : LLONG_MAX;
+    unsigned long long abs_val = 0;
+    for (; *str; ++str) {
+        unsigned digit = (unsigned)(*str - '0');
+        if (digit > 9)
+            return DOCOPT_VALUE_INVALID;
+        if (abs_val > (limit - digit) / 10)
+            return DOCOPT_VALUE_RANGE;
+        abs_val = abs_val * 10 + digit;
+    }
+    *val = is_neg && abs_val != 0 ? -(long long)(abs_val - 1) - 1 : (long long)abs_val;
+    return DOCOPT_VALUE_OK;
+}
+
+// Slow path of docopt_parse_float(), without locale or allocation: the number
+// is held as decimal digits in a fixed buffer, and scaled by powers of two
+// until its integer part holds the 53 bits of the result, which is rounded
+// from the remaining digits (as in the "simple decimal conversion" of Go).
+// Digits beyond the buffer only matter to break ties, so they are not kept.
+#define DOCOPT_DECIMAL_DIGITS 800
+
+typedef struct DocoptDecimal {
+    unsigned char digits[DOCOPT_DECIMAL_DIGITS + 20];
+    int digit_count;
+    long point;  // the value is 0.<digits> * 10^point
+    bool is_truncated;
+} DocoptDecimal;
+
+static inline void docopt_trim_decimal(DocoptDecimal* dec) {
+    while (dec->digit_count > 0 && dec->digits[dec->digit_count - 1] == 0)
+        dec->digit_count--;
+    if (dec->digit_count == 0)
+        dec->point = 0;
+}
+
+// Reads the digits validated by docopt_parse_float(), before the exponent
+static inline void docopt_read_decimal(DocoptDecimal* dec, const char* str, long exp) {
+    dec->digit_count = 0;
+    dec->point = 0;
+    dec->is_truncated = false;
+    bool is_fraction = false;
+    for (; (*str >= '0' && *str <= '9') || *str == '.'; ++str) {
+        if (*str == '.') {
+            is_fraction = true;
+        } else if (*str == '0' && dec->digit_count == 0) {
+            dec->point -= is_fraction;
+        } else {
+            dec->point += !is_fraction;
+            if (dec->digit_count < DOCOPT_DECIMAL_DIGITS)
+                dec->digits[dec->digit_count++] = (unsigned char)(*str - '0');
+            else if (*str != '0')
+                dec->is_truncated = true;
+        }
+    }
+    dec->point += exp;
+    docopt_trim_decimal(dec);
+}
+
+// Multiplies by 2^shift, for shift <= 60. The digits are written backwards
+// from the end of the buffer, which has room for the 19 new digits at most.
+static inline void docopt_shift_decimal_left(DocoptDecimal* dec, unsigned shift) {
+    int read = dec->digit_count;
+    int write = dec->digit_count + 19;
+    unsigned long long n = 0;
+    while (read > 0 || n > 0) {
+        if (read > 0)
+            n += (unsigned long long)dec->digits[--read] << shift;
+        unsigned long long quotient = n / 10;
+        dec->digits[--write] = (unsigned char)(n - quotient * 10);
+        n = quotient;
+    }
+    int count = dec->digit_count + 19 - write;
+    dec->point += count - dec->digit_count;
+    for (int i = DOCOPT_DECIMAL_DIGITS; i < count; ++i)
+        dec->is_truncated |= dec->digits[write + i] != 0;
+    dec->digit_count = count < DOCOPT_DECIMAL_DIGITS ? count : DOCOPT_DECIMAL_DIGITS;
+    memmove(dec->digits, dec->digits + write, (size_t)dec->digit_count);
+    docopt_trim_decimal(dec);
+}
+
+// Divides by 2^shift, for shift <= 60
+static inline void docopt_shift_decimal_right(DocoptDecimal* dec, unsigned shift) {
+    int read = 0;
+    int write = 0;
+    unsigned long long n = 0;
+    for (; (n >> shift) == 0; ++read) {
+        if (read >= dec->digit_count) {
+            if (n == 0) {
+                dec->digit_count = 0;
+                dec->point = 0;
+                return;
+            }
+            for (; (n >> shift) == 0; ++read)
+                n *= 10;
+            break;
+        }
+        n = n * 10 + dec->digits[read];
+    }
+    dec->point -= read - 1;
+
+    unsigned long long mask = (1ull << shift) - 1;
+    for (; read < dec->digit_count; ++read) {
+        dec->digits[write++] = (unsigned char)(n >> shift);
+        n = (n & mask) * 10 + dec->digits[read];
+    }
+    for (; n > 0; n = (n & mask) * 10) {
+        unsigned char digit = (unsigned char)(n >> shift);
+        if (write < DOCOPT_DECIMAL_DIGITS)
+            dec->digits[write++] = digit;
+        else
+            dec->is_truncated |= digit != 0;
+    }
+    dec->digit_count = write;
+    docopt_trim_decimal(dec);
+}
+
+static inline void docopt_shift_decimal(DocoptDecimal* dec, int shift) {
+    for (; shift > 60; shift -= 60)
+        docopt_shift_decimal_left(dec, 60);
+    for (; shift < -60; shift += 60)
+        docopt_shift_decimal_right(dec, 60);
+    if (shift > 0)
+        docopt_shift_decimal_left(dec, (unsigned)shift);
+    else if (shift < 0)
+        docopt_shift_decimal_right(dec, (unsigned)-shift);
+}
+
+// Returns the integer part, rounded half to even, for a point <= 19
+static inline unsigned long long docopt_round_decimal(const DocoptDecimal* dec) {
+    if (dec->point < 0)
+        return 0;
+    unsigned long long n = 0;
+    int i = 0;
+    for (; i < dec->point; ++i)
+        n = n * 10 + (i < dec->digit_count ? dec->digits[i] : 0);
+    if (i >= dec->digit_count)
+        return n;
+    if (dec->digits[i] == 5 && i + 1 == dec->digit_count && !dec->is_truncated)
+        return n + (n & 1);
+    return n + (dec->digits[i] >= 5);
+}
+
+// Assumes that doubles are IEEE 754 binary64 numbers
+static inline double docopt_decimal_to_double(DocoptDecimal* dec, bool* is_overflow) {
+    // Shifts that keep a digit before the point when the point is at index i
+    static const int shifts[] = { 1, 3, 6, 9, 13, 16, 19, 23, 26 };
+    *is_overflow = false;
+    if (dec->digit_count == 0 || dec->point < -330)
+        return 0;
+    if (dec->point > 310) {
+        *is_overflow = true;
+        return 0;
+    }
+
+    // Scales the number into [0.5, 1)
+    int exp = 0;
+    while (dec->point > 0) {
+        int shift = dec->point >= 9 ? 27 : shifts[dec->point];
+        docopt_shift_decimal(dec, -shift);
+        exp += shift;
+    }
+    while (dec->point < 0 || (dec->point == 0 && dec->digits[0] < 5)) {
+        int shift = -dec->point >= 9 ? 27 : shifts[-dec->point];
+        docopt_shift_decimal(dec, shift);
+        exp -= shift;
+    }
+    exp--;
+
+    // Subnormal numbers keep fewer bits
+    if (exp < -1022) {
+        docopt_shift_decimal(dec, exp + 1022);
+        exp = -1022;
+    }
+    docopt_shift_decimal(dec, 53);
+    unsigned long long mantissa = docopt_round_decimal(dec);
+    if (mantissa == 1ull << 53) {
+        mantissa >>= 1;
+        exp++;
+    }
+    if (exp > 1023) {
+        *is_overflow = true;
+        return 0;
+    }
+    unsigned long long biased_exp = mantissa >> 52 ? (unsigned long long)(exp + 1023) : 0;
+    unsigned long long bits = (mantissa & ((1ull << 52) - 1)) | biased_exp << 52;
+    double val = 0;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+static inline int docopt_parse_float(const char* str, double* val) {
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    bool is_neg = *str == '-';
+    str += *str == '-' || *str == '+';
+    const char* begin = str;
+
+    unsigned long long mantissa = 0;
+    size_t digit_count = 0;
+    bool is_exact = true;
+    long exp = 0;
+    for (; *str >= '0' && *str <= '9'; ++str, ++digit_count) {
+        if (mantissa < (ULLONG_MAX - 9) / 10)
+            mantissa = mantissa * 10 + (unsigned)(*str - '0');
+        else
+            exp++, is_exact = false;
+    }
+    if (*str == '.') {
+        for (++str; *str >= '0' && *str <= '9'; ++str, ++digit_count) {
+            if (mantissa < (ULLONG_MAX - 9) / 10)
+                mantissa = mantissa * 10 + (unsigned)(*str - '0'), exp--;
+            else
+                is_exact = false;
+        }
+    }
+    if (digit_count == 0)
+        return DOCOPT_VALUE_INVALID;
+    long exp_part = 0;
+    if (*str == 'e' || *str == 'E') {
+        str++;
+        bool is_exp_neg = *str == '-';
+        str += *str == '-' || *str == '+';
+        if (*str < '0' || *str > '9')
+            return DOCOPT_VALUE_INVALID;
+        for (; *str >= '0' && *str <= '9'; ++str) {
+            if (exp_part < 100000)
+                exp_part = exp_part * 10 + (*str - '0');
+        }
+        exp_part = is_exp_neg ? -exp_part : exp_part;
+        exp += exp_part;
+    }
+    if (*str != 0)
+        return DOCOPT_VALUE_INVALID;
+
+    // The result is correctly rounded when both the mantissa and the power of
+    // ten are exact doubles, and otherwise computed from the decimal digits.
+    // Default values are converted by the compiler in the same way.
+    double abs_val = 0;
+    if (is_exact && mantissa <= (1ull << 53) && exp >= -22 && exp <= 22) {
+        abs_val = exp >= 0 ? (double)mantissa * powers[exp] : (double)mantissa / powers[-exp];
+    } else {
+        DocoptDecimal dec;
+        docopt_read_decimal(&dec, begin, exp_part);
+        bool is_overflow = false;
+        abs_val = docopt_decimal_to_double(&dec, &is_overflow);
+        if (is_overflow)
+            return DOCOPT_VALUE_RANGE;
+    }
+    *val = is_neg ? -abs_val : abs_val;
+    return DOCOPT_VALUE_OK;
+}
+
+// Also used by the compiler to check default values. The C++ runtime accepts
+// the same spellings.
+static inline int docopt_parse_bool(const char* str, bool* val) {
+    static const char* const true_strs[]  = { "true",  "yes", "on",  "1" };
+    static const char* const false_strs[] = { "false", "no",  "off", "0" };
+    for (size_t i = 0; i < sizeof(true_strs) / sizeof(true_strs[0]); ++i) {
+        if (!strcmp(str, true_strs[i]) || !strcmp(str, false_strs[i])) {
+            *val = !strcmp(str, true_strs[i]);
+            return DOCOPT_VALUE_OK;
+        }
+    }
+    return DOCOPT_VALUE_INVALID;
+}
+
+static inline int docopt_parse_choice(const char* str, const DocoptOption* option, int* val) {
+    for (size_t i = 0; i < option->choice_count; ++i) {
+        if (!strcmp(str, option->choices[i])) {
+            *val = (int)i;
+            return DOCOPT_VALUE_OK;
+        }
+    }
+    return DOCOPT_VALUE_INVALID;
+}
+
+static inline int docopt_option_error(const DocoptContext* context, const DocoptOption* option, const char* msg) {
+    if (option->long_name)
+        return docopt_error(context, "option '--%s' %s", option->long_name, msg);
+    return docopt_error(context, "option '-%c' %s", option->short_name, msg);
+}
+
+static inline int docopt_store_option(const DocoptContext* context, const DocoptOption* option, const char* val) {
+    char* field = (char*)context->args + option->offset;
+    int status = DOCOPT_VALUE_OK;
+    switch (option->kind) {
+        case DOCOPT_FLAG:   *(bool*)field = true;        break;
+        case DOCOPT_COUNT:  (*(unsigned*)field)++;       break;
+        case DOCOPT_STRING: *(const char**)field = val;  break;
+        case DOCOPT_INT:    status = docopt_parse_int(val, (long long*)field);     break;
+        case DOCOPT_FLOAT:  status = docopt_parse_float(val, (double*)field);      break;
+        case DOCOPT_BOOL:   status = docopt_parse_bool(val, (bool*)field);         break;
+        case DOCOPT_CHOICE: status = docopt_parse_choice(val, option, (int*)field); break;
+        default:
+            break;
+    }
+    if (status == DOCOPT_VALUE_RANGE)
+        return docopt_option_error(context, option, "has an out-of-range value");
+    if (status == DOCOPT_VALUE_INVALID)
+        return docopt_option_error(context, option, option->kind == DOCOPT_CHOICE ? "has an invalid choice" : "has an invalid value");
+    return DOCOPT_OK;
+}
+
+static inline const DocoptOption* docopt_find_long(const DocoptSpec* spec, const char* name, size_t len) {
+    if (spec->find_long)
+        return spec->find_long(name, len);
+    for (size_t i = 0; i < spec->option_count; ++i) {
+        const char* long_name = spec->options[i].long_name;
+        if (long_name && !strncmp(long_name, name, len) && long_name[len] == 0)
+            return &spec->options[i];
+    }
+    return NULL;
+}
+
+// Parsers generated for size have no short option table
+static inline DocoptShort docopt_find_short(const DocoptSpec* spec, unsigned char name) {
+    if (spec->shorts)
+        return spec->shorts[name];
+    for (size_t i = 0; i < spec->option_count; ++i) {
+        if ((unsigned char)spec->options[i].short_name == name) {
+            unsigned char action = spec->options[i].kind >= DOCOPT_STRING ? DOCOPT_SHORT_VALUE : DOCOPT_SHORT_FLAG;
+            return (DocoptShort) { action, (unsigned)i };
+        }
+    }
+    return (DocoptShort) { DOCOPT_SHORT_NONE, 0 };
+}
+
+static inline void docopt_use_option(DocoptMatch* match, unsigned index) {
+    if (!match->used[index]) {
+        match->used[index] = true;
+        match->used_options[match->used_count++] = index;
+    }
+}
+
+static inline void docopt_undo_options(DocoptMatch* match, size_t used_count) {
+    while (match->used_count > used_count)
+        match->used[match->used_options[--match->used_count]] = false;
+}
+
+// Every given option must be consumed by the usage, or by its '[options]'
+// shortcut when the option appears in no usage
+static inline bool docopt_uses_given_options(const DocoptMatch* match) {
+    const DocoptSpec* spec = match->spec;
+    bool has_shortcut = match->used[spec->option_count];
+    if (match->used_count - has_shortcut == match->given_count)
+        return true;
+    if (!has_shortcut)
+        return false;
+    for (size_t i = 0; i < spec->option_count; ++i) {
+        if (match->given[i] && !match->used[i] && spec->options[i].is_in_usage)
+            return false;
+    }
+    return true;
+}
+
+// Matches positional arguments against a usage pattern, greedily, in the same
+// way as the reference docopt implementation, and marks the options that the
+// pattern consumes. Returns the position after the last consumed argument, or
+// DOCOPT_FAIL. Callers that go on after a failure undo its marks.
+static inline size_t docopt_match(DocoptMatch* match, const DocoptNode* node, size_t pos) {
+    const DocoptNode* end = node + node->size;
+    const DocoptNode* child;
+    size_t next_pos;
+    switch (node->tag) {
+        case DOCOPT_NODE_COMMAND:
+            if (pos >= match->pos_count || strcmp(match->pos[pos].str, match->spec->positionals[node->index].name))
+                return DOCOPT_FAIL;
+            match->pos[pos].slot = node->index;
+            return pos + 1;
+        case DOCOPT_NODE_ARG:
+            if (pos >= match->pos_count)
+                return DOCOPT_FAIL;
+            match->pos[pos].slot = node->index;
+            return pos + 1;
+        case DOCOPT_NODE_OPTION:
+            if (!match->given[node->index])
+                return DOCOPT_FAIL;
+            docopt_use_option(match, node->index);
+            return pos;
+        case DOCOPT_NODE_ANY_OPTIONS:
+            docopt_use_option(match, (unsigned)match->spec->option_count);
+            return pos;
+        case DOCOPT_NODE_SEQ:
+            for (child = node + 1; child != end && pos != DOCOPT_FAIL; child += child->size)
+                pos = docopt_match(match, child, pos);
+            return pos;
+        case DOCOPT_NODE_OPTIONAL:
+            for (child = node + 1; child != end; child += child->size) {
+                size_t used_count = match->used_count;
+                if ((next_pos = docopt_match(match, child, pos)) != DOCOPT_FAIL)
+                    pos = next_pos;
+                else
+                    docopt_undo_options(match, used_count);
+            }
+            return pos;
+        case DOCOPT_NODE_OR: {
+            // Ties are broken by the number of consumed options, since the
+            // reference implementation prefers the alternative that leaves the
+            // fewest arguments
+            const DocoptNode* best_child = NULL;
+            size_t best_pos = DOCOPT_FAIL, best_used = 0, used_count = match->used_count;
+            for (child = node + 1; child != end; child += child->size) {
+                next_pos = docopt_match(match, child, pos);
+                if (next_pos != DOCOPT_FAIL && (best_pos == DOCOPT_FAIL || next_pos > best_pos ||
+                    (next_pos == best_pos && match->used_count > best_used)))
+                    best_pos = next_pos, best_used = match->used_count, best_child = child;
+                if (child + child->size != end)
+                    docopt_undo_options(match, used_count);
+            }
+            // Matching the best alternative again restores its slots and options
+            if (best_child && best_child + best_child->size != end) {
+                docopt_undo_options(match, used_count);
+                docopt_match(match, best_child, pos);
+            }
+            return best_pos;
+        }
+        case DOCOPT_NODE_REPEAT:
+            if ((pos = docopt_match(match, node + 1, pos)) == DOCOPT_FAIL)
+                return DOCOPT_FAIL;
+            while (true) {
+                size_t used_count = match->used_count;
+                if ((next_pos = docopt_match(match, node + 1, pos)) == DOCOPT_FAIL)
+                    docopt_undo_options(match, used_count);
+                if (next_pos == DOCOPT_FAIL || next_pos == pos)
+                    return pos;
+                pos = next_pos;
+            }
+        default:
+            return DOCOPT_FAIL;
+    }
+}
+
+// Stores repeated arguments in lists. Lists whose items are contiguous in the
+// token array, which is the common case for long argument lists, refer to the
+// tokens directly. Other lists are copied.
+static inline int docopt_store_lists(const DocoptContext* context, const DocoptMatch* match) {
+    const DocoptSpec* spec = context->spec;
+    size_t copy_size = 0;
+    for (size_t i = 0; i < spec->positional_count; ++i) {
+        if (spec->positionals[i].kind != DOCOPT_ARG_LIST)
+            continue;
+        DocoptList* list = (DocoptList*)((char*)context->args + spec->positionals[i].offset);
+        int first_index = -1;
+        bool is_contiguous = true;
+        list->count = 0;
+        for (size_t j = 0; j < match->pos_count; ++j) {
+            if (match->pos[j].slot != i)
+                continue;
+            if (list->count == 0)
+                first_index = match->pos[j].index;
+            else if (first_index < 0 || match->pos[j].index != first_index + (int)list->count)
+                is_contiguous = false;
+            list->count++;
+        }
+        list->items = NULL;
+        if (list->count > 0 && is_contiguous && first_index >= 0)
+            list->items = (const char* const*)context->tokens + first_index;
+        else
+            copy_size += list->count;
+    }
+    if (copy_size == 0)
+        return DOCOPT_OK;
+
+    const char** items = docopt_alloc(context, sizeof(const char*) * copy_size);
+    if (!items)
+        return docopt_error(context, "not enough memory");
+    for (size_t i = 0; i < spec->positional_count; ++i) {
+        DocoptList* list = (DocoptList*)((char*)context->args + spec->positionals[i].offset);
+        if (spec->positionals[i].kind != DOCOPT_ARG_LIST || list->items || list->count == 0)
+            continue;
+        list->items = items;
+        for (size_t j = 0; j < match->pos_count; ++j) {
+            if (match->pos[j].slot == i)
+                *(items++) = match->pos[j].str;
+        }
+    }
+    return DOCOPT_OK;
+}
+
+static inline int docopt_store_positionals(const DocoptContext* context, const DocoptMatch* match) {
+    const DocoptSpec* spec = context->spec;
+    for (size_t i = 0; i < match->pos_count; ++i) {
+        const DocoptPositional* positional = &spec->positionals[match->pos[i].slot];
+        char* field = (char*)context->args + positional->offset;
+        switch (positional->kind) {
+            case DOCOPT_COMMAND:       *(bool*)field = true;                     break;
+            case DOCOPT_COMMAND_COUNT: (*(unsigned*)field)++;                    break;
+            case DOCOPT_ARG:           *(const char**)field = match->pos[i].str; break;
+            default:
+                break;
+        }
+    }
+    return docopt_store_lists(context, match);
+}
+
+static inline bool docopt_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+enum {
+    DOCOPT_SCAN_END,
+    DOCOPT_SCAN_TOKEN,
+    DOCOPT_SCAN_ERROR
+};
+
+// Scans the next token in the given buffer, following the quoting rules of
+// POSIX shells for single quotes, double quotes and backslashes. Quotes are
+// removed in place. The token is null-terminated, unless it ends exactly at
+// the end of the buffer, in which case there is no room left for the terminator.
+static inline int docopt_scan_token(char** in_ptr, char* end, char** token, char** token_end) {
+    char* in = *in_ptr;
+    while (in != end && docopt_is_space(*in))
+        in++;
+    *in_ptr = in;
+    if (in == end)
+        return DOCOPT_SCAN_END;
+
+    char* out = in;
+    char quote = 0;
+    *token = out;
+    for (; in != end; ++in) {
+        if (quote) {
+            if (*in == quote) {
+                quote = 0;
+                continue;
+            }
+            if (quote == '"' && *in == '\\' && in + 1 != end && (in[1] == '"' || in[1] == '\\'))
+                in++;
+        } else if (*in == '\'' || *in == '"') {
+            quote = *in;
+            continue;
+        } else if (*in == '\\' && in + 1 != end)
+            in++;
+        else if (docopt_is_space(*in))
+            break;
+        *(out++) = *in;
+    }
+    if (quote)
+        return DOCOPT_SCAN_ERROR;
+
+    *token_end = out;
+    if (out != end)
+        *out = 0;
+    *in_ptr = in != end ? in + 1 : in;
+    return DOCOPT_SCAN_TOKEN;
+}
+
+// Splits a command line into tokens in place. The tokens point into the given
+// string, and no memory is allocated. Returns the number of tokens, or -1 if
+// there are more than max_tokens or a quote is unterminated.
+static inline int docopt_split(char* str, char** tokens, int max_tokens, char* error) {
+    char* end = str + strlen(str);
+    char* token;
+    char* token_end;
+    int count = 0, status;
+    while ((status = docopt_scan_token(&str, end, &token, &token_end)) == DOCOPT_SCAN_TOKEN) {
+        if (count >= max_tokens) {
+            snprintf(error, DOCOPT_ERROR_SIZE, "too many arguments");
+            return -1;
+        }
+        tokens[count++] = token;
+    }
+    if (status == DOCOPT_SCAN_ERROR) {
+        snprintf(error, DOCOPT_ERROR_SIZE, "unterminated quote");
+        return -1;
+    }
+    return count;
+}
+
+// Maps a response file in memory. The mapping is private, so that tokens can be
+// unquoted and terminated in place without modifying the file.
+static inline int docopt_load_file(const DocoptContext* context, const char* file_name, char** begin, char** end) {
+    size_t size = 0;
+    char* data = NULL;
+#ifdef DOCOPT_HAS_MMAP
+    int fd = open(file_name, O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return docopt_error(context, "cannot open response file '%s'", file_name);
+    }
+    size = (size_t)file_stat.st_size;
+    void* map = size > 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (map == MAP_FAILED)
+        return docopt_error(context, "cannot map response file '%s'", file_name);
+    if (map) {
+        if (!docopt_alloc(context, 0)) {
+            munmap(map, size);
+            return docopt_error(context, "not enough memory");
+        }
+        (*context->mem)->map = map;
+        (*context->mem)->map_size = size;
+        data = map;
+    }
+#else
+    FILE* file = fopen(file_name, "rb");
+    if (!file)
+        return docopt_error(context, "cannot open response file '%s'", file_name);
+    long file_size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    size = file_size > 0 ? (size_t)file_size : 0;
+    if (file_size < 0 || fseek(file, 0, SEEK_SET) != 0 || !(data = docopt_alloc(context, size))) {
+        fclose(file);
+        return docopt_error(context, "cannot read response file '%s'", file_name);
+    }
+    size = fread(data, 1, size, file);
+    fclose(file);
+#endif
+    *begin = data;
+    *end = data + size;
+    return DOCOPT_OK;
+}
+
+// Returns the next token, or NULL if there are none left. Response files are
+// tokenized lazily, one token at a time, when they are enabled.
+static inline int docopt_next_token(const DocoptContext* context, DocoptCursor* cursor, const char** token, int* index) {
+    while (true) {
+        if (cursor->file_pos) {
+            char* begin;
+            char* end;
+            int status = docopt_scan_token(&cursor->file_pos, cursor->file_end, &begin, &end);
+            if (status == DOCOPT_SCAN_ERROR)
+                return docopt_error(context, "unterminated quote in response file");
+            if (status == DOCOPT_SCAN_TOKEN) {
+                if (end == cursor->file_end) {
+                    char* copy = docopt_alloc(context, (size_t)(end - begin) + 1);
+                    if (!copy)
+                        return docopt_error(context, "not enough memory");
+                    memcpy(copy, begin, (size_t)(end - begin));
+                    copy[end - begin] = 0;
+                    begin = copy;
+                }
+                *token = begin;
+                *index = -1;
+                return DOCOPT_OK;
+            }
+            cursor->file_pos = NULL;
+        }
+
+        if (cursor->index >= cursor->count) {
+            *token = NULL;
+            return DOCOPT_OK;
+        }
+        const char* arg = context->tokens[cursor->index];
+        if (context->spec->response_files && arg[0] == '@' && arg[1] != 0) {
+            cursor->index++;
+            if (docopt_load_file(context, arg + 1, &cursor->file_pos, &cursor->file_end) != DOCOPT_OK)
+                return DOCOPT_ERROR;
+            continue;
+        }
+        *token = arg;
+        *index = cursor->index++;
+        return DOCOPT_OK;
+    }
+}
+
+static inline int docopt_push_pos(const DocoptContext* context, DocoptMatch* match, const char* str, int index) {
+    if (match->pos_count == match->pos_cap) {
+        size_t new_cap = match->pos_cap * 2;
+        DocoptPos* new_pos = match->is_pos_on_heap
+            ? realloc(match->pos, sizeof(DocoptPos) * new_cap)
+            : malloc(sizeof(DocoptPos) * new_cap);
+        if (!new_pos)
+            return docopt_error(context, "not enough memory");
+        if (!match->is_pos_on_heap)
+            memcpy(new_pos, match->pos, sizeof(DocoptPos) * match->pos_count);
+        match->pos = new_pos;
+        match->pos_cap = new_cap;
+        match->is_pos_on_heap = true;
+    }
+    match->pos[match->pos_count++] = (DocoptPos) { .str = str, .index = index };
+    return DOCOPT_OK;
+}
+
+// Stores options in the result structure, and collects positional arguments
+static inline int docopt_extract_options(const DocoptContext* context, int count, DocoptMatch* match, bool* given) {
+    const DocoptSpec* spec = context->spec;
+    DocoptCursor cursor = { .count = count };
+    bool only_pos = false;
+    while (true) {
+        const char* arg;
+        int index;
+        if (docopt_next_token(context, &cursor, &arg, &index) != DOCOPT_OK)
+            return DOCOPT_ERROR;
+        if (!arg)
+            return DOCOPT_OK;
+
+        if (only_pos || arg[0] != '-' || arg[1] == 0) {
+            if (docopt_push_pos(context, match, arg, index) != DOCOPT_OK)
+                return DOCOPT_ERROR;
+        } else if (arg[1] == '-') {
+            if (arg[2] == 0) {
+                only_pos = true;
+                continue;
+            }
+            const char* name = arg + 2;
+            const char* val = strchr(name, '=');
+            const DocoptOption* option = docopt_find_long(spec, name, val ? (size_t)(val - name) : strlen(name));
+            if (!option)
+                return docopt_error(context, "unknown option '%s'", arg);
+            if (option->kind >= DOCOPT_STRING) {
+                if (val)
+                    val++;
+                else if (docopt_next_token(context, &cursor, &val, &index) != DOCOPT_OK)
+                    return DOCOPT_ERROR;
+                else if (!val)
+                    return docopt_option_error(context, option, "requires an argument");
+            } else if (val)
+                return docopt_option_error(context, option, "does not take an argument");
+            if (docopt_store_option(context, option, val) != DOCOPT_OK)
+                return DOCOPT_ERROR;
+            match->given_count += !given[option - spec->options];
+            given[option - spec->options] = true;
+        } else {
+            for (const unsigned char* name = (const unsigned char*)arg + 1; *name; ++name) {
+                DocoptShort entry = docopt_find_short(spec, *name);
+                if (entry.action == DOCOPT_SHORT_NONE)
+                    return docopt_error(context, "unknown option '-%c'", *name);
+                const DocoptOption* option = &spec->options[entry.option];
+                const char* val = NULL;
+                if (entry.action == DOCOPT_SHORT_VALUE) {
+                    if (name[1])
+                        val = (const char*)name + 1;
+                    else if (docopt_next_token(context, &cursor, &val, &index) != DOCOPT_OK)
+                        return DOCOPT_ERROR;
+                    else if (!val)
+                        return docopt_option_error(context, option, "requires an argument");
+                }
+                if (docopt_store_option(context, option, val) != DOCOPT_OK)
+                    return DOCOPT_ERROR;
+                match->given_count += !given[entry.option];
+                given[entry.option] = true;
+                if (val)
+                    break;
+            }
+        }
+    }
+}
+
+// Writes the counters of an instrumented parser. Counters from previous runs are
+// accumulated, so that a profile can cover many invocations. The profile file
+// can be overridden with the DOCOPT_PROFILE environment variable.
+static inline void docopt_dump_profile(const DocoptSpec* spec) {
+    DocoptProfile* profile = spec->profile;
+    const char* file_name = getenv("DOCOPT_PROFILE");
+    if (!file_name)
+        file_name = profile->file_name;
+
+    FILE* file = fopen(file_name, "r");
+    if (file) {
+        char prog[64], kind[8];
+        size_t usage_count, option_count, index;
+        unsigned long long count;
+        if (fscanf(file, "docopt-profile %63s %zu %zu", prog, &usage_count, &option_count) == 3 &&
+            !strcmp(prog, spec->prog) && usage_count == spec->usage_count && option_count == spec->option_count)
+        {
+            while (fscanf(file, " %7s %zu %llu", kind, &index, &count) == 3) {
+                if (!strcmp(kind, "usage") && index < usage_count)
+                    profile->usage_counts[index] += count;
+                else if (!strcmp(kind, "option") && index < option_count)
+                    profile->option_counts[index] += count;
+            }
+        }
+        fclose(file);
+    }
+
+    if (!(file = fopen(file_name, "w")))
+        return;
+    fprintf(file, "docopt-profile %s %zu %zu\n", spec->prog, spec->usage_count, spec->option_count);
+    for (size_t i = 0; i < spec->usage_count; ++i)
+        fprintf(file, "usage %zu %llu\n", i, profile->usage_counts[i]);
+    for (size_t i = 0; i < spec->option_count; ++i)
+        fprintf(file, "option %zu %llu\n", i, profile->option_counts[i]);
+    fclose(file);
+}
+
+static inline void docopt_record_profile(const DocoptSpec* spec, size_t usage, const bool* given) {
+    DocoptProfile* profile = spec->profile;
+    if (!profile->is_registered)
+        profile->is_registered = atexit(profile->dump) == 0;
+    profile->usage_counts[usage]++;
+    for (size_t i = 0; i < spec->option_count; ++i)
+        profile->option_counts[i] += given[i];
+}
+
+static inline int docopt_match_usages(const DocoptContext* context, DocoptMatch* match) {
+    const DocoptSpec* spec = context->spec;
+    for (size_t i = 0; i < spec->usage_count; ++i) {
+        docopt_undo_options(match, 0);
+        size_t end = spec->matchers
+            ? spec->matchers[i](match, 0)
+            : docopt_match(match, spec->nodes + spec->usages[i], 0);
+        if (end != match->pos_count || !docopt_uses_given_options(match))
+            continue;
+        if (spec->profile)
+            docopt_record_profile(spec, i, match->given);
+        return docopt_store_positionals(context, match);
+    }
+    return docopt_error(context, "invalid usage");
+}
+
+// Help and version options end parsing as soon as they are given. The compiler
+// lists them in the spec, and the interpreter uses this function to find them.
+static inline bool docopt_is_exit_option(const DocoptOption* option) {
+    if (option->kind >= DOCOPT_STRING)
+        return false;
+    if (option->long_name)
+        return !strcmp(option->long_name, "help") || !strcmp(option->long_name, "version");
+    return option->short_name == 'h';
+}
+
+static inline bool docopt_is_listed_exit_option(const DocoptSpec* spec, const DocoptOption* option) {
+    for (size_t i = 0; i < spec->exit_option_count; ++i) {
+        if (&spec->options[spec->exit_options[i]] == option)
+            return true;
+    }
+    return false;
+}
+
+// Finds a help or version option given before '--'. Tokens are walked as when
+// options are extracted, so that the values of other options are skipped.
+// Unknown options are left for the parser to report.
+static inline const DocoptOption* docopt_find_exit_option(const DocoptContext* context, int count) {
+    const DocoptSpec* spec = context->spec;
+    for (int i = 0; i < count; ++i) {
+        const char* token = context->tokens[i];
+        if (token[0] != '-' || token[1] == 0)
+            continue;
+        if (!strcmp(token, "--"))
+            break;
+        if (token[1] == '-') {
+            const char* name = token + 2;
+            const char* val = strchr(name, '=');
+            const DocoptOption* option = docopt_find_long(spec, name, val ? (size_t)(val - name) : strlen(name));
+            if (option && !val && docopt_is_listed_exit_option(spec, option))
+                return option;
+            i += option && !val && option->kind >= DOCOPT_STRING;
+            continue;
+        }
+        for (const unsigned char* name = (const unsigned char*)token + 1; *name; ++name) {
+            DocoptShort entry = docopt_find_short(spec, *name);
+            if (entry.action == DOCOPT_SHORT_NONE)
+                break;
+            const DocoptOption* option = &spec->options[entry.option];
+            if (docopt_is_listed_exit_option(spec, option))
+                return option;
+            if (entry.action == DOCOPT_SHORT_VALUE) {
+                i += name[1] == 0;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Handles the command lines that are decided without matching: when a help or
+// version option is given, it is set and the other arguments are ignored, as in
+// the reference implementation. Command lines without options are matched
+// directly against trivial usages.
+static inline bool docopt_parse_early(const DocoptContext* context, int count) {
+    const DocoptSpec* spec = context->spec;
+    const DocoptOption* exit_option = spec->exit_option_count > 0 ? docopt_find_exit_option(context, count) : NULL;
+    if (exit_option) {
+        // Help and version options take no argument, and an empty value
+        // keeps compilers from assuming that a null one may be parsed
+        docopt_store_option(context, exit_option, "");
+        return true;
+    }
+    if (count == 0)
+        return spec->accepts_empty;
+    const char* token = context->tokens[0];
+    if (count == 1 && spec->single_arg && (token[0] != '-' || token[1] == 0)) {
+        *(const char**)((char*)context->args + spec->single_arg->offset) = token;
+        return true;
+    }
+    return false;
+}
+
+// Parses the given tokens, which do not include the program name. This function
+// is reentrant: working buffers live on the stack for small inputs, and the only
+// memory that outlives the call is attached to the result structure.
+static inline int docopt_parse(const DocoptSpec* spec, void* args, DocoptMem** mem, char* error, int count, char* const* tokens) {
+    DocoptContext context = {
+        .spec = spec,
+        .args = args,
+        .mem = mem,
+        .error = error,
+        .tokens = tokens
+    };
+    if (docopt_parse_early(&context, count))
+        return DOCOPT_OK;
+
+    DocoptPos pos_buf[DOCOPT_STACK_SIZE];
+    unsigned used_options_buf[DOCOPT_STACK_SIZE + 1];
+    bool given_buf[DOCOPT_STACK_SIZE];
+    bool used_buf[DOCOPT_STACK_SIZE + 1];
+    DocoptMatch match = {
+        .spec = spec,
+        .pos = pos_buf,
+        .pos_cap = DOCOPT_STACK_SIZE,
+        .used = used_buf,
+        .used_options = used_options_buf
+    };
+
+    // Option arrays share a single allocation for larger specs
+    size_t option_count = spec->option_count;
+    bool* given = given_buf;
+    if (option_count > DOCOPT_STACK_SIZE) {
+        if (!(match.used_options = malloc((option_count + 1) * (sizeof(unsigned) + 2 * sizeof(bool)))))
+            return docopt_error(&context, "not enough memory");
+        given = (bool*)(match.used_options + option_count + 1);
+        match.used = given + option_count;
+    }
+    memset(given, 0, option_count * sizeof(bool));
+    memset(match.used, 0, (option_count + 1) * sizeof(bool));
+    match.given = given;
+
+    int status = DOCOPT_OK;
+    if (count > DOCOPT_STACK_SIZE) {
+        match.pos = malloc(sizeof(DocoptPos) * (size_t)count);
+        match.pos_cap = (size_t)count;
+        match.is_pos_on_heap = true;
+        if (!match.pos)
+            status = docopt_error(&context, "not enough memory");
+    }
+
+    if (status == DOCOPT_OK)
+        status = docopt_extract_options(&context, count, &match, given);
+    if (status == DOCOPT_OK)
+        status = docopt_match_usages(&context, &match);
+    if (match.is_pos_on_heap)
+        free(match.pos);
+    if (match.used_options != used_options_buf)
+        free(match.used_options);
+    return status;
+}
+
+#endif
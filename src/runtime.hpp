@@ -0,0 +1,542 @@
+// Runtime support for C++ parsers generated by docoptc (requires C++20).
+// This file is embedded verbatim in the generated code, and guarded so that
+// several generated parsers can be included in the same translation unit.
+// Usage patterns are encoded as types, so that matching is specialized for
+// each grammar at compile time.
+#ifndef DOCOPTC_RUNTIME_HPP
+#define DOCOPTC_RUNTIME_HPP
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+namespace docopt {
+
+inline constexpr std::size_t error_size = 128;
+inline constexpr std::size_t stack_size = 64;
+inline constexpr std::size_t fail = std::size_t(-1);
+
+struct Error {
+    char message[error_size] = {};
+};
+
+// Kinds of option fields. Options with a kind greater or equal to
+// Kind::string take an argument.
+enum class Kind : unsigned char {
+    flag,
+    count,
+    string,
+    int_value,
+    float_value,
+    bool_value,
+    choice
+};
+
+enum class PositionalKind : unsigned char {
+    command,
+    command_count,
+    arg,
+    arg_list
+};
+
+enum class Value {
+    ok,
+    invalid,
+    range
+};
+
+// Options that appear in no usage can only be given with the '[options]'
+// shortcut
+struct Option {
+    std::string_view long_name;
+    char short_name;
+    Kind kind;
+    bool is_in_usage;
+    std::span<const std::string_view> choices;
+
+    constexpr bool takes_value() const { return kind >= Kind::string; }
+};
+
+struct Positional {
+    std::string_view name;
+    PositionalKind kind;
+};
+
+enum class ShortAction : unsigned char {
+    none,
+    flag,
+    value
+};
+
+struct Short {
+    ShortAction action;
+    unsigned option;
+};
+
+template <std::size_t N>
+constexpr std::array<Short, 256> make_shorts(const std::array<Option, N>& options) {
+    std::array<Short, 256> shorts{};
+    for (std::size_t i = 0; i < N; ++i) {
+        if (options[i].short_name) {
+            shorts[static_cast<unsigned char>(options[i].short_name)] = {
+                options[i].takes_value() ? ShortAction::value : ShortAction::flag,
+                static_cast<unsigned>(i)
+            };
+        }
+    }
+    return shorts;
+}
+
+template <typename Spec>
+constexpr std::size_t find_long(std::string_view name) {
+    for (std::size_t i = 0; i < Spec::options.size(); ++i) {
+        if (!name.empty() && Spec::options[i].long_name == name)
+            return i;
+    }
+    return fail;
+}
+
+// Help and version options end parsing as soon as they are given, as in the C
+// runtime
+constexpr bool is_exit_option(const Option& option) {
+    if (option.takes_value())
+        return false;
+    if (!option.long_name.empty())
+        return option.long_name == "help" || option.long_name == "version";
+    return option.short_name == 'h';
+}
+
+// Finds a help or version option given before '--'. Tokens are walked as when
+// options are parsed, so that the values of other options are skipped.
+template <typename Spec>
+constexpr std::size_t find_exit_option(std::span<const std::string_view> tokens, const std::array<Short, 256>& shorts) {
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        std::string_view arg = tokens[i];
+        if (arg.size() < 2 || arg[0] != '-')
+            continue;
+        if (arg == "--")
+            break;
+        if (arg[1] == '-') {
+            std::string_view name = arg.substr(2);
+            std::size_t eq = name.find('=');
+            std::size_t index = find_long<Spec>(name.substr(0, eq));
+            if (index == fail || eq != std::string_view::npos)
+                continue;
+            if (is_exit_option(Spec::options[index]))
+                return index;
+            i += Spec::options[index].takes_value();
+            continue;
+        }
+        for (std::size_t j = 1; j < arg.size(); ++j) {
+            Short entry = shorts[static_cast<unsigned char>(arg[j])];
+            if (entry.action == ShortAction::none)
+                break;
+            if (is_exit_option(Spec::options[entry.option]))
+                return entry.option;
+            if (entry.action == ShortAction::value) {
+                i += j + 1 == arg.size();
+                break;
+            }
+        }
+    }
+    return fail;
+}
+
+template <typename... Args>
+inline bool error(Error& error, const char* format_str, Args... args) {
+    std::snprintf(error.message, error_size, format_str, args...);
+    return false;
+}
+
+inline bool option_error(Error& error, const Option& option, const char* msg) {
+    if (!option.long_name.empty())
+        return docopt::error(error, "option '--%.*s' %s", static_cast<int>(option.long_name.size()), option.long_name.data(), msg);
+    return docopt::error(error, "option '-%c' %s", option.short_name, msg);
+}
+
+inline Value parse_int(std::string_view str, long long& val) {
+    if (str.size() > 1 && str[0] == '+' && str[1] != '-')
+        str.remove_prefix(1);
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), val);
+    if (str.empty() || end != str.data() + str.size())
+        return Value::invalid;
+    return ec == std::errc::result_out_of_range ? Value::range : ec == std::errc() ? Value::ok : Value::invalid;
+}
+
+inline Value parse_float(std::string_view str, double& val) {
+    // Only decimal notation is accepted, as in the C runtime
+    std::size_t sign = !str.empty() && (str[0] == '+' || str[0] == '-');
+    if (str.size() == sign || (str[sign] != '.' && (str[sign] < '0' || str[sign] > '9')))
+        return Value::invalid;
+    auto [end, ec] = std::from_chars(str.data() + (str[0] == '+'), str.data() + str.size(), val, std::chars_format::general);
+    if (end != str.data() + str.size())
+        return Value::invalid;
+    return ec == std::errc::result_out_of_range ? Value::range : ec == std::errc() ? Value::ok : Value::invalid;
+}
+
+inline Value parse_bool(std::string_view str, bool& val) {
+    constexpr std::string_view true_strs[]  = { "true",  "yes", "on",  "1" };
+    constexpr std::string_view false_strs[] = { "false", "no",  "off", "0" };
+    for (std::size_t i = 0; i < std::size(true_strs); ++i) {
+        if (str == true_strs[i] || str == false_strs[i]) {
+            val = str == true_strs[i];
+            return Value::ok;
+        }
+    }
+    return Value::invalid;
+}
+
+inline bool check_value(Error& error, const Option& option, Value status) {
+    if (status == Value::range)
+        return option_error(error, option, "has an out-of-range value");
+    if (status == Value::invalid)
+        return option_error(error, option, option.kind == Kind::choice ? "has an invalid choice" : "has an invalid value");
+    return true;
+}
+
+// Option fields are stored according to their type
+inline bool store(bool& field, const Option& option, std::string_view val, Error& error) {
+    if (option.kind == Kind::flag)
+        return field = true;
+    return check_value(error, option, parse_bool(val, field));
+}
+
+inline bool store(unsigned& field, const Option&, std::string_view, Error&) {
+    field++;
+    return true;
+}
+
+inline bool store(std::string_view& field, const Option&, std::string_view val, Error&) {
+    field = val;
+    return true;
+}
+
+inline bool store(long long& field, const Option& option, std::string_view val, Error& error) {
+    return check_value(error, option, parse_int(val, field));
+}
+
+inline bool store(double& field, const Option& option, std::string_view val, Error& error) {
+    return check_value(error, option, parse_float(val, field));
+}
+
+template <typename E> requires std::is_enum_v<E>
+inline bool store(E& field, const Option& option, std::string_view val, Error& error) {
+    for (std::size_t i = 0; i < option.choices.size(); ++i) {
+        if (option.choices[i] == val) {
+            field = static_cast<E>(i);
+            return true;
+        }
+    }
+    return check_value(error, option, Value::invalid);
+}
+
+inline void store_positional(bool& field, std::string_view) { field = true; }
+inline void store_positional(unsigned& field, std::string_view) { field++; }
+inline void store_positional(std::string_view& field, std::string_view str) { field = str; }
+inline void store_positional(std::span<const std::string_view>&, std::string_view) {}
+
+inline void store_list(std::span<const std::string_view>& field, std::span<const std::string_view> items) { field = items; }
+template <typename T>
+inline void store_list(T&, std::span<const std::string_view>) {}
+
+// Maps field indices to members of the result structure
+template <auto... Members>
+struct Fields {
+    template <typename Args, typename F>
+    static constexpr bool visit([[maybe_unused]] Args& args, [[maybe_unused]] std::size_t index, [[maybe_unused]] F&& f) {
+        bool ok = true;
+        [[maybe_unused]] std::size_t i = 0;
+        ((i++ == index ? (void)(ok = f(args.*Members)) : void()), ...);
+        return ok;
+    }
+};
+
+// Positional argument, and the positional field it is matched with
+struct Pos {
+    std::string_view str;
+    unsigned slot;
+};
+
+// Options consumed by the usage being matched are marked in `used`, and listed
+// in `used_options`, so that the marks of failed alternatives can be undone. The
+// '[options]' shortcut is marked as an extra option, after the others.
+struct Match {
+    std::span<Pos> pos;
+    const bool* given;
+    std::size_t given_count;
+    bool* used;
+    unsigned* used_options;
+    std::size_t used_count;
+
+    void use(std::size_t index) {
+        if (!used[index]) {
+            used[index] = true;
+            used_options[used_count++] = static_cast<unsigned>(index);
+        }
+    }
+
+    void undo(std::size_t count) {
+        while (used_count > count)
+            used[used_options[--used_count]] = false;
+    }
+};
+
+// Every given option must be consumed by the usage, or by its '[options]'
+// shortcut when the option appears in no usage
+template <typename Spec>
+inline bool uses_given_options(const Match& match) {
+    bool has_shortcut = match.used[Spec::options.size()];
+    if (match.used_count - has_shortcut == match.given_count)
+        return true;
+    if (!has_shortcut)
+        return false;
+    for (std::size_t i = 0; i < Spec::options.size(); ++i) {
+        if (match.given[i] && !match.used[i] && Spec::options[i].is_in_usage)
+            return false;
+    }
+    return true;
+}
+
+// Nodes of usage patterns. Matching is greedy, in the same way as the reference
+// docopt implementation, and returns the position after the last consumed
+// argument, or `fail`. Callers that go on after a failure undo its options.
+template <std::size_t I>
+struct Command {
+    template <typename Spec>
+    static std::size_t match(Match& match, std::size_t pos) {
+        if (pos >= match.pos.size() || match.pos[pos].str != Spec::positionals[I].name)
+            return fail;
+        match.pos[pos].slot = I;
+        return pos + 1;
+    }
+};
+
+template <std::size_t I>
+struct Arg {
+    template <typename Spec>
+    static std::size_t match(Match& match, std::size_t pos) {
+        if (pos >= match.pos.size())
+            return fail;
+        match.pos[pos].slot = I;
+        return pos + 1;
+    }
+};
+
+template <std::size_t I>
+struct Opt {
+    template <typename Spec>
+    static std::size_t match(Match& match, std::size_t pos) {
+        if (!match.given[I])
+            return fail;
+        match.use(I);
+        return pos;
+    }
+};
+
+struct AnyOptions {
+    template <typename Spec>
+    static std::size_t match(Match& match, std::size_t pos) {
+        match.use(Spec::options.size());
+        return pos;
+    }
+};
+
+template <typename... Children>
+struct Seq {
+    template <typename Spec>
+    static std::size_t match([[maybe_unused]] Match& match, std::size_t pos) {
+        ((pos = pos != fail ? Children::template match<Spec>(match, pos) : fail), ...);
+        return pos;
+    }
+};
+
+template <typename... Children>
+struct Optional {
+    template <typename Spec>
+    static std::size_t match([[maybe_unused]] Match& match, std::size_t pos) {
+        [[maybe_unused]] std::size_t next_pos, used_count;
+        ((used_count = match.used_count,
+          (next_pos = Children::template match<Spec>(match, pos)) != fail ? (void)(pos = next_pos) : match.undo(used_count)), ...);
+        return pos;
+    }
+};
+
+template <typename... Children>
+struct Or {
+    template <typename Spec>
+    static std::size_t match(Match& match, std::size_t pos) {
+        // Ties are broken by the number of consumed options, as in the C runtime
+        std::size_t best_pos = fail, best_child = 0, best_used = 0, used_count = match.used_count, next_pos, i = 0;
+        ((next_pos = Children::template match<Spec>(match, pos),
+          next_pos != fail && (best_pos == fail || next_pos > best_pos || (next_pos == best_pos && match.used_count > best_used))
+            ? (void)(best_pos = next_pos, best_child = i, best_used = match.used_count) : void(),
+          ++i != sizeof...(Children) ? match.undo(used_count) : void()), ...);
+        // Matching the best alternative again restores its slots and options
+        if (best_pos != fail && best_child + 1 != sizeof...(Children)) {
+            match.undo(used_count);
+            i = 0;
+            ((i++ == best_child ? (void)Children::template match<Spec>(match, pos) : void()), ...);
+        }
+        return best_pos;
+    }
+};
+
+template <typename Child>
+struct Repeat {
+    template <typename Spec>
+    static std::size_t match(Match& match, std::size_t pos) {
+        if ((pos = Child::template match<Spec>(match, pos)) == fail)
+            return fail;
+        while (true) {
+            std::size_t used_count = match.used_count;
+            std::size_t next_pos = Child::template match<Spec>(match, pos);
+            if (next_pos == fail)
+                match.undo(used_count);
+            if (next_pos == fail || next_pos == pos)
+                return pos;
+            pos = next_pos;
+        }
+    }
+};
+
+template <typename... Patterns>
+struct Usages {
+    template <typename Spec>
+    static bool match(Match& match) {
+        return ((match.undo(0), Patterns::template match<Spec>(match, 0) == match.pos.size() && uses_given_options<Spec>(match)) || ...);
+    }
+};
+
+template <typename Spec, typename Args>
+inline bool store_option(Args& args, std::size_t index, std::string_view val, Error& error) {
+    return Spec::option_fields::visit(args, index, [&] (auto& field) {
+        return store(field, Spec::options[index], val, error);
+    });
+}
+
+// Parses the given tokens, which do not include the program name. Values refer
+// to the token strings. List items are moved to the beginning of the token
+// array, in order, so that lists can refer to it without allocating memory.
+template <typename Spec, typename Args>
+inline bool parse(Args& args, std::span<std::string_view> tokens, Error& error) {
+    static constexpr std::array<Short, 256> shorts = make_shorts(Spec::options);
+    static constexpr bool has_exit_options = [] {
+        for (const Option& option : Spec::options) {
+            if (is_exit_option(option))
+                return true;
+        }
+        return false;
+    }();
+    if constexpr (has_exit_options) {
+        std::size_t index = find_exit_option<Spec>(tokens, shorts);
+        if (index != fail)
+            return store_option<Spec>(args, index, {}, error);
+    }
+
+    Pos pos_buf[stack_size];
+    std::unique_ptr<Pos[]> pos_heap;
+    Pos* pos = pos_buf;
+    if (tokens.size() > stack_size) {
+        pos_heap.reset(new (std::nothrow) Pos[tokens.size()]);
+        if (!pos_heap)
+            return docopt::error(error, "not enough memory");
+        pos = pos_heap.get();
+    }
+
+    std::array<bool, Spec::options.size()> given{};
+    std::array<bool, Spec::options.size() + 1> used{};
+    std::array<unsigned, Spec::options.size() + 1> used_options;
+    std::size_t given_count = 0, pos_count = 0;
+    bool only_pos = false;
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        std::string_view arg = tokens[i];
+        if (only_pos || arg.size() < 2 || arg[0] != '-') {
+            pos[pos_count++] = { arg, 0 };
+        } else if (arg[1] == '-') {
+            if (arg.size() == 2) {
+                only_pos = true;
+                continue;
+            }
+            std::string_view name = arg.substr(2);
+            std::size_t eq = name.find('=');
+            std::size_t index = find_long<Spec>(name.substr(0, eq));
+            if (index == fail)
+                return docopt::error(error, "unknown option '%.*s'", static_cast<int>(arg.size()), arg.data());
+            const Option& option = Spec::options[index];
+            std::string_view val;
+            if (option.takes_value()) {
+                if (eq != std::string_view::npos)
+                    val = name.substr(eq + 1);
+                else if (i + 1 < tokens.size())
+                    val = tokens[++i];
+                else
+                    return option_error(error, option, "requires an argument");
+            } else if (eq != std::string_view::npos)
+                return option_error(error, option, "does not take an argument");
+            if (!store_option<Spec>(args, index, val, error))
+                return false;
+            given_count += !given[index];
+            given[index] = true;
+        } else {
+            for (std::size_t j = 1; j < arg.size(); ++j) {
+                Short entry = shorts[static_cast<unsigned char>(arg[j])];
+                if (entry.action == ShortAction::none)
+                    return docopt::error(error, "unknown option '-%c'", arg[j]);
+                const Option& option = Spec::options[entry.option];
+                std::string_view val;
+                bool has_val = entry.action == ShortAction::value;
+                if (has_val) {
+                    if (j + 1 < arg.size())
+                        val = arg.substr(j + 1);
+                    else if (i + 1 < tokens.size())
+                        val = tokens[++i];
+                    else
+                        return option_error(error, option, "requires an argument");
+                }
+                if (!store_option<Spec>(args, entry.option, val, error))
+                    return false;
+                given_count += !given[entry.option];
+                given[entry.option] = true;
+                if (has_val)
+                    break;
+            }
+        }
+    }
+
+    Match match { std::span<Pos>(pos, pos_count), given.data(), given_count, used.data(), used_options.data(), 0 };
+    if (!Spec::usages::template match<Spec>(match))
+        return docopt::error(error, "invalid usage");
+    for (std::size_t i = 0; i < pos_count; ++i) {
+        Spec::positional_fields::visit(args, pos[i].slot, [&] (auto& field) {
+            store_positional(field, pos[i].str);
+            return true;
+        });
+    }
+    // All other values have been copied at this point, so the token array can be overwritten
+    std::size_t item_count = 0;
+    for (std::size_t slot = 0; slot < Spec::positionals.size(); ++slot) {
+        if (Spec::positionals[slot].kind != PositionalKind::arg_list)
+            continue;
+        std::size_t first = item_count;
+        for (std::size_t i = 0; i < pos_count; ++i) {
+            if (pos[i].slot == slot)
+                tokens[item_count++] = pos[i].str;
+        }
+        Spec::positional_fields::visit(args, slot, [&] (auto& field) {
+            store_list(field, tokens.subspan(first, item_count - first));
+            return true;
+        });
+    }
+    return true;
+}
+
+} // namespace docopt
+
+#endif
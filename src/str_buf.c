@@ -2,6 +2,8 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
 
 #define MIN_BUF_SIZE 32
 
@@ -29,6 +31,19 @@ void append_char(StrBuf* buf, const char c) {
     buf->data[buf->size++] = c;
 }
 
+void append_fmt(StrBuf* buf, const char* format_str, ...) {
+    va_list args, args_copy;
+    va_start(args, format_str);
+    va_copy(args_copy, args);
+    int len = vsnprintf(NULL, 0, format_str, args);
+    if (buf->cap < buf->size + len + 1)
+        grow_buf(buf, buf->size + len + 1);
+    vsnprintf(buf->data + buf->size, len + 1, format_str, args_copy);
+    buf->size += len;
+    va_end(args_copy);
+    va_end(args);
+}
+
 void free_str_buf(StrBuf* buf) {
     free(buf->data);
 }
@@ -12,5 +12,6 @@ StrBuf make_str_buf(void);
 void free_str_buf(StrBuf*);
 void append_str(StrBuf*, const char*, size_t);
 void append_char(StrBuf*, const char);
+void append_fmt(StrBuf*, const char* format_str, ...);
 
 #endif
@@ -0,0 +1,75 @@
+#include "str_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_TABLE_CAP 16
+
+static inline uint32_t hash_str(const char* str) {
+    // FNV-1a
+    uint32_t hash = UINT32_C(0x811c9dc5);
+    for (; *str; ++str)
+        hash = (hash ^ (unsigned char)*str) * UINT32_C(0x01000193);
+    return hash;
+}
+
+StrTable make_str_table(void) {
+    return (StrTable) {
+        .keys = calloc(MIN_TABLE_CAP, sizeof(const char*)),
+        .vals = malloc(sizeof(uint32_t) * MIN_TABLE_CAP),
+        .cap = MIN_TABLE_CAP,
+        .count = 0
+    };
+}
+
+void free_str_table(StrTable* table) {
+    free(table->keys);
+    free(table->vals);
+}
+
+static inline size_t find_index(const StrTable* table, const char* key) {
+    size_t mask = table->cap - 1;
+    size_t index = hash_str(key) & mask;
+    while (table->keys[index] && strcmp(table->keys[index], key))
+        index = (index + 1) & mask;
+    return index;
+}
+
+bool find_in_str_table(const StrTable* table, const char* key, uint32_t* val) {
+    size_t index = find_index(table, key);
+    if (!table->keys[index])
+        return false;
+    *val = table->vals[index];
+    return true;
+}
+
+static void grow_table(StrTable* table) {
+    StrTable new_table = {
+        .keys = calloc(table->cap * 2, sizeof(const char*)),
+        .vals = malloc(sizeof(uint32_t) * table->cap * 2),
+        .cap = table->cap * 2,
+        .count = table->count
+    };
+    for (size_t i = 0; i < table->cap; ++i) {
+        if (!table->keys[i])
+            continue;
+        size_t index = find_index(&new_table, table->keys[i]);
+        new_table.keys[index] = table->keys[i];
+        new_table.vals[index] = table->vals[i];
+    }
+    free_str_table(table);
+    *table = new_table;
+}
+
+bool insert_in_str_table(StrTable* table, const char* key, uint32_t val) {
+    // Keep the load factor below 1/2
+    if (2 * (table->count + 1) > table->cap)
+        grow_table(table);
+    size_t index = find_index(table, key);
+    if (table->keys[index])
+        return false;
+    table->keys[index] = key;
+    table->vals[index] = val;
+    table->count++;
+    return true;
+}
@@ -0,0 +1,21 @@
+#ifndef STR_TABLE_H
+#define STR_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hash table from strings to integers, using open addressing. Keys are not
+// copied, and must outlive the table.
+typedef struct StrTable {
+    const char** keys;
+    uint32_t* vals;
+    size_t cap, count;
+} StrTable;
+
+StrTable make_str_table(void);
+void free_str_table(StrTable*);
+bool find_in_str_table(const StrTable*, const char* key, uint32_t* val);
+bool insert_in_str_table(StrTable*, const char* key, uint32_t val);
+
+#endif
@@ -1,8 +1,27 @@
 #include "syntax.h"
 #include "utils.h"
+#include "log.h"
+#include "str_table.h"
+#include "runtime.h"
 
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+const char* get_arg_type_name(ArgType type) {
+    switch (type) {
+        case ARG_TYPE_STRING: return "string";
+        case ARG_TYPE_INT:    return "int";
+        case ARG_TYPE_FLOAT:  return "float";
+        case ARG_TYPE_BOOL:   return "bool";
+        case ARG_TYPE_CHOICE: return "choice";
+        default:
+            assert(false && "invalid argument type");
+            return "";
+    }
+}
 
 static void print_arg(FILE* file, const char* name) {
     if (is_upper_case(name))
@@ -41,6 +60,10 @@ void print_syntax(FILE* file, const Syntax* syntax) {
             fprintf(file, "  %s", syntax->desc.info);
             if (syntax->desc.default_val)
                 fprintf(file, " # defaults to '%s'", syntax->desc.default_val);
+            if (syntax->desc.arg_type != ARG_TYPE_STRING)
+                fprintf(file, " # of type '%s'", get_arg_type_name(syntax->desc.arg_type));
+            for (size_t i = 0; i < syntax->desc.choice_count; ++i)
+                fprintf(file, "%s'%s'", i == 0 ? " # one of " : ", ", syntax->desc.choices[i]);
             break;
         case SYNTAX_COMMAND:
             fprintf(file, "%s", syntax->command.name);
@@ -83,36 +106,104 @@ void print_syntax(FILE* file, const Syntax* syntax) {
     }
 }
 
-static void check_usages(Syntax* usages) {
+static void check_usages(Log* log, Syntax* usages) {
     for (Syntax* usage = usages; usage; usage = usage->next) {
         if (strcmp(usage->usage.prog, usages->usage.prog)) {
-            error_at(&usage->range, "expected program name '%s', but got '%s'",
+            error_at(log, &usage->range, "expected program name '%s', but got '%s'",
                 usages->usage.prog, usage->usage.prog);
         }
     }
 }
 
-static void check_descs(const Syntax* descs) {
+static bool is_valid_default_val(const Syntax* desc) {
+    const char* val = desc->desc.default_val;
+    errno = 0;
+    switch (desc->desc.arg_type) {
+        case ARG_TYPE_INT:
+            return is_int_literal(val) && (strtoll(val, NULL, 10), errno != ERANGE);
+        case ARG_TYPE_FLOAT: {
+            double float_val = 0;
+            return is_float_literal(val) && docopt_parse_float(val, &float_val) == DOCOPT_VALUE_OK;
+        }
+        case ARG_TYPE_BOOL: {
+            // Same spellings as on the command line
+            bool bool_val = false;
+            return docopt_parse_bool(val, &bool_val) == DOCOPT_VALUE_OK;
+        }
+        case ARG_TYPE_CHOICE:
+            for (size_t i = 0; i < desc->desc.choice_count; ++i) {
+                if (!strcmp(val, desc->desc.choices[i]))
+                    return true;
+            }
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void check_choices(Log* log, const Syntax* desc) {
+    const char** choices = desc->desc.choices;
+    if (desc->desc.choice_count == 0)
+        error_at(log, &desc->range, "list of choices cannot be empty");
+    StrTable seen = make_str_table();
+    for (size_t i = 0; i < desc->desc.choice_count; ++i) {
+        if (!insert_in_str_table(&seen, choices[i], (uint32_t)i))
+            error_at(log, &desc->range, "choice '%s' appears more than once", choices[i]);
+    }
+    free_str_table(&seen);
+}
+
+static void check_descs(Log* log, const Syntax* descs) {
+    StrTable long_opts = make_str_table();
+    bool short_opts[UCHAR_MAX + 1] = { false };
     for (const Syntax* desc = descs; desc; desc = desc->next) {
         const Syntax* first_opt = desc->desc.elems;
         const Syntax* other_opt = first_opt->next;
         bool has_arg = first_opt->option.arg;
 
+        for (const Syntax* opt = first_opt; opt; opt = opt->next) {
+            if (opt->option.is_short && strlen(opt->option.name) != 1)
+                error_at(log, &opt->range, "short option '-%s' must be a single character", opt->option.name);
+            bool is_new = opt->option.is_short
+                ? !short_opts[(unsigned char)opt->option.name[0]]
+                : insert_in_str_table(&long_opts, opt->option.name, 0);
+            if (opt->option.is_short)
+                short_opts[(unsigned char)opt->option.name[0]] = true;
+            if (!is_new)
+                error_at(log, &opt->range, "option '%s' is described more than once", opt->option.name);
+        }
+
         if (other_opt && has_arg != !!other_opt->option.arg) {
-            error_at(&other_opt->range, "option '%s' requires an argument, but option '%s' does not",
+            error_at(log, &other_opt->range, "option '%s' requires an argument, but option '%s' does not",
                 (has_arg ? first_opt : other_opt)->option.name,
                 (has_arg ? other_opt : first_opt)->option.name);
         }
 
         if (!has_arg && desc->desc.default_val) {
-            error_at(&desc->range, "option '%s' has no arguments and cannot have a default value",
+            error_at(log, &desc->range, "option '%s' has no arguments and cannot have a default value",
                 first_opt->option.name);
         }
+
+        if (!has_arg && desc->desc.arg_type != ARG_TYPE_STRING) {
+            error_at(log, &desc->range, "option '%s' has no arguments and cannot have a type",
+                first_opt->option.name);
+        }
+
+        if (desc->desc.arg_type == ARG_TYPE_CHOICE)
+            check_choices(log, desc);
+
+        if (has_arg && desc->desc.default_val && !is_valid_default_val(desc)) {
+            error_at(log, &desc->range, "default value '%s' of option '%s' is not a valid %s",
+                desc->desc.default_val, first_opt->option.name, get_arg_type_name(desc->desc.arg_type));
+        }
     }
+    free_str_table(&long_opts);
 }
 
-void check_syntax(const Syntax* root) {
+void check_syntax(const Syntax* root, Log* log) {
     assert(root->tag == SYNTAX_ROOT);
-    check_usages(root->root.usages);
-    check_descs(root->root.descs);
+    if (!root->root.usages)
+        error_at(log, &root->range, "expected at least one usage");
+    check_usages(log, root->root.usages);
+    check_descs(log, root->root.descs);
 }
@@ -7,6 +7,7 @@
 #include <stdbool.h>
 
 typedef struct Syntax Syntax;
+typedef struct Log    Log;
 
 typedef enum {
     SYNTAX_ERROR,
@@ -24,6 +25,14 @@ typedef enum {
     SYNTAX_OR
 } SyntaxTag;
 
+typedef enum {
+    ARG_TYPE_STRING,
+    ARG_TYPE_INT,
+    ARG_TYPE_FLOAT,
+    ARG_TYPE_BOOL,
+    ARG_TYPE_CHOICE
+} ArgType;
+
 struct Syntax {
     SyntaxTag tag;
     SourceRange range;
@@ -42,6 +51,9 @@ struct Syntax {
             Syntax* elems;
             const char* info;
             const char* default_val;
+            ArgType arg_type;
+            const char** choices;
+            size_t choice_count;
         } desc;
         struct {
             const char* name;
@@ -66,7 +78,8 @@ struct Syntax {
     };
 };
 
+const char* get_arg_type_name(ArgType);
 void print_syntax(FILE*, const Syntax*);
-void check_syntax(const Syntax*);
+void check_syntax(const Syntax*, Log*);
 
 #endif
@@ -1,15 +1,11 @@
 #include "utils.h"
-#include "token.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <stdarg.h>
-#include <stdio.h>
-#include <inttypes.h>
 #include <ctype.h>
 
-char* read_file(const char* file_name) {
+char* read_file(const char* file_name, size_t* file_size) {
     static const size_t chunk_size = 1024;
 
     FILE* file = fopen(file_name, "r");
@@ -30,6 +26,7 @@ char* read_file(const char* file_name) {
 
     buf = realloc(buf, pos + 1);
     buf[pos] = 0;
+    *file_size = pos;
     return buf;
 }
 
@@ -58,12 +55,32 @@ bool is_upper_case_n(const char* str, size_t n) {
     return true;
 }
 
-void error_at(const SourceRange* range, const char* format_str, ...) {
-    va_list args;
-    va_start(args, format_str);
-    fprintf(stderr, "error in %s(%"PRIu32":%"PRIu32" - %"PRIu32":%"PRIu32"): ",
-        range->file_name, range->begin.row, range->begin.col, range->end.row, range->end.col);
-    vfprintf(stderr, format_str, args);
-    va_end(args);
-    fprintf(stderr, "\n");
+static inline const char* skip_digits(const char* str) {
+    while (isdigit(*str))
+        str++;
+    return str;
+}
+
+bool is_int_literal(const char* str) {
+    str += *str == '+' || *str == '-';
+    const char* end = skip_digits(str);
+    return end != str && *end == 0;
+}
+
+bool is_float_literal(const char* str) {
+    str += *str == '+' || *str == '-';
+    const char* int_end = skip_digits(str);
+    const char* frac_end = int_end;
+    if (*int_end == '.')
+        frac_end = skip_digits(int_end + 1);
+    if (int_end == str && frac_end <= int_end + 1)
+        return false;
+    if (*frac_end == 'e' || *frac_end == 'E') {
+        const char* exp = frac_end + 1;
+        exp += *exp == '+' || *exp == '-';
+        frac_end = skip_digits(exp);
+        if (frac_end == exp)
+            return false;
+    }
+    return *frac_end == 0;
 }
@@ -4,12 +4,11 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-typedef struct SourceRange SourceRange;
-
-char* read_file(const char* file_name);
+char* read_file(const char* file_name, size_t* file_size);
 bool compare_lower_case(const char*, const char*, size_t n);
 bool is_upper_case(const char*);
 bool is_upper_case_n(const char*, size_t);
-void error_at(const SourceRange* pos, const char* format_str, ...);
+bool is_int_literal(const char*);
+bool is_float_literal(const char*);
 
 #endif
@@ -0,0 +1,96 @@
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define EVENT_BUF_SIZE 4096
+
+typedef struct WatchedFile {
+    char* dir;
+    const char* base_name;
+    int wd;
+} WatchedFile;
+
+static WatchedFile make_watched_file(const char* file_name) {
+    const char* slash = strrchr(file_name, '/');
+    const char* dir_name = slash ? file_name : ".";
+    size_t dir_len = !slash || slash == file_name ? 1 : (size_t)(slash - file_name);
+    char* dir = malloc(dir_len + 1);
+    memcpy(dir, dir_name, dir_len);
+    dir[dir_len] = 0;
+    return (WatchedFile) {
+        .dir = dir,
+        .base_name = slash ? slash + 1 : file_name,
+        .wd = -1
+    };
+}
+
+bool watch_files(char* const* file_names, size_t file_count, WatchCallback callback, void* data) {
+    int fd = inotify_init();
+    if (fd < 0) {
+        perror("cannot watch files");
+        return false;
+    }
+
+    // Watching the same directory twice returns the same descriptor
+    bool ok = true;
+    WatchedFile* files = malloc(sizeof(WatchedFile) * file_count);
+    for (size_t i = 0; i < file_count; ++i) {
+        files[i] = make_watched_file(file_names[i]);
+        files[i].wd = inotify_add_watch(fd, files[i].dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (files[i].wd < 0) {
+            fprintf(stderr, "cannot watch directory '%s'\n", files[i].dir);
+            ok = false;
+        }
+    }
+
+    bool* is_changed = calloc(file_count, sizeof(bool));
+    alignas(struct inotify_event) char buf[EVENT_BUF_SIZE];
+    while (ok) {
+        ssize_t size = read(fd, buf, sizeof(buf));
+        if (size <= 0) {
+            perror("cannot read file events");
+            break;
+        }
+        // Events are batched, so that a file changed several times is only compiled once
+        for (char* ptr = buf; ptr < buf + size;) {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            for (size_t i = 0; i < file_count && event->len > 0; ++i)
+                is_changed[i] |= files[i].wd == event->wd && !strcmp(files[i].base_name, event->name);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+        for (size_t i = 0; i < file_count; ++i) {
+            if (is_changed[i])
+                callback(i, data);
+            is_changed[i] = false;
+        }
+    }
+
+    for (size_t i = 0; i < file_count; ++i)
+        free(files[i].dir);
+    free(files);
+    free(is_changed);
+    close(fd);
+    return false;
+}
+
+#else
+
+#include <stdio.h>
+
+bool watch_files(char* const* file_names, size_t file_count, WatchCallback callback, void* data) {
+    (void)file_names;
+    (void)file_count;
+    (void)callback;
+    (void)data;
+    fprintf(stderr, "watching files is not supported on this platform\n");
+    return false;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef void (*WatchCallback)(size_t file_index, void* data);
+
+// Calls the callback with the index of every file that is modified, until an
+// error occurs. Files are watched through their directories, so that editors
+// replacing a file by renaming a new one are also detected.
+// Only supported on Linux (with inotify), returns false otherwise.
+bool watch_files(char* const* file_names, size_t file_count, WatchCallback, void* data);
+
+#endif
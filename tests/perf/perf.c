@@ -0,0 +1,422 @@
+// Checks that the compiler runs in (near) linear time on adversarial inputs.
+// Specs of the corpus are templates: the text between '{{' and '}}' is repeated
+// n times, with '$' replaced by the repetition number. Every phase is timed at
+// sizes n and 2n, and fails when its time grows by more than the given ratio.
+// With --threads, large instances are parsed on 1 to N threads instead, and the
+// speedups are reported.
+
+#include "docoptc.h"
+#include "lexer.h"
+#include "parser.h"
+#include "syntax.h"
+#include "grammar.h"
+#include "codegen.h"
+#include "profile.h"
+#include "mem_pool.h"
+#include "str_buf.h"
+#include "log.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs are repeated, and the fastest one is kept, to filter out noise
+#define RUN_COUNT 3
+// Each phase is repeated for at least this long in a run
+#define MIN_PHASE_TIME 0.02
+// Specs that look unbounded are measured at larger sizes, up to this many
+// times in total
+#define MAX_ATTEMPTS 3
+// The size n is doubled until a run takes at least this long
+#define MIN_RUN_TIME 0.02
+#define MAX_SPEC_SIZE (16 << 20)
+// Phases faster than this are too noisy to compare
+#define TIME_SLACK 0.001
+// Size from which specs are parsed on several threads by the benchmark
+#define BENCH_SPEC_SIZE (8 << 20)
+
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_CHECK,
+    PHASE_GRAMMAR,
+    PHASE_PROFILE,
+    PHASE_C,
+    PHASE_C_SIZE,
+    PHASE_C_SPEED,
+    PHASE_CPP,
+    PHASE_IMAGE,
+    PHASE_BASH,
+    PHASE_COUNT
+} Phase;
+
+static const char* phase_names[] = {
+    "lex", "parse", "check", "grammar", "profile", "c", "c -Os", "c -O3", "cpp", "image", "bash"
+};
+
+static const CodegenOptions phase_options[] = {
+    [PHASE_C]       = { .target = TARGET_C },
+    [PHASE_C_SIZE]  = { .target = TARGET_C, .opt_level = OPT_SIZE },
+    [PHASE_C_SPEED] = { .target = TARGET_C, .opt_level = OPT_SPEED },
+    [PHASE_CPP]     = { .target = TARGET_CPP },
+    [PHASE_IMAGE]   = { .target = TARGET_IMAGE },
+    [PHASE_BASH]    = { .target = TARGET_BASH }
+};
+
+static double get_time(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void instantiate(StrBuf* buf, const char* tmpl, size_t count) {
+    buf->size = 0;
+    const char* begin;
+    while ((begin = strstr(tmpl, "{{"))) {
+        const char* end = strstr(begin + 2, "}}");
+        if (!end)
+            break;
+        append_str(buf, tmpl, begin - tmpl);
+        for (size_t i = 1; i <= count; ++i) {
+            for (const char* ptr = begin + 2; ptr != end; ++ptr) {
+                if (*ptr == '$')
+                    append_fmt(buf, "%zu", i);
+                else
+                    append_char(buf, *ptr);
+            }
+        }
+        tmpl = end + 2;
+    }
+    append_str(buf, tmpl, strlen(tmpl));
+    // The spec is also used as the doc string
+    append_char(buf, 0);
+    buf->size--;
+}
+
+static void emit_target(StrBuf* buf, const Grammar* grammar, const CodegenOptions* options) {
+    if (options->target == TARGET_CPP)
+        emit_cpp_code(buf, grammar, options);
+    else if (options->target == TARGET_IMAGE)
+        emit_image(buf, grammar, options);
+    else if (options->target == TARGET_BASH)
+        emit_bash_completion(buf, grammar, options);
+    else
+        emit_c_code(buf, grammar, options);
+}
+
+// Gives pseudo-random counts to usages and options, so that they get reordered
+static Profile make_test_profile(const Grammar* grammar) {
+    Profile profile = {
+        .file_name = "perf.profile",
+        .prog = (char*)grammar->prog,
+        .usage_count = grammar->usage_count,
+        .option_count = grammar->option_count,
+        .entry_count = grammar->usage_count + grammar->option_count
+    };
+    profile.entries = malloc(sizeof(ProfileEntry) * (profile.entry_count + 1));
+    for (size_t i = 0; i < profile.entry_count; ++i) {
+        bool is_usage = i < grammar->usage_count;
+        uint64_t index = is_usage ? i : i - grammar->usage_count;
+        profile.entries[i] = (ProfileEntry) { is_usage, index, (index * 2654435761u) % 1000 };
+    }
+    return profile;
+}
+
+typedef struct PhaseRunner {
+    const StrBuf* spec;
+    SourceRange range;
+    MemPool mem_pool;
+    Log log;
+    Syntax* syntax;
+    Grammar* grammar;
+    Profile profile;
+    StrBuf output;
+} PhaseRunner;
+
+// Runs a phase on the results of the previous ones. Every phase can be run
+// several times in a row.
+static void run_phase(PhaseRunner* runner, Phase phase) {
+    switch (phase) {
+        case PHASE_LEX: {
+            Lexer lexer = make_range_lexer(runner->spec->data, &runner->range);
+            while (lex(&lexer).tag != TOKEN_END);
+            break;
+        }
+        case PHASE_PARSE: {
+            reset_mem_pool(&runner->mem_pool);
+            free_log(&runner->log);
+            runner->log = make_log();
+            Lexer lexer = make_range_lexer(runner->spec->data, &runner->range);
+            Parser parser = make_parser(&runner->mem_pool, &lexer, &runner->log);
+            runner->syntax = parse(&parser);
+            break;
+        }
+        case PHASE_CHECK:
+            check_syntax(runner->syntax, &runner->log);
+            break;
+        case PHASE_GRAMMAR:
+            runner->grammar = build_grammar(&runner->mem_pool, runner->syntax, runner->spec->data, &runner->log);
+            break;
+        case PHASE_PROFILE:
+            apply_profile(runner->grammar, &runner->profile, &runner->log);
+            break;
+        default:
+            runner->output.size = 0;
+            emit_target(&runner->output, runner->grammar, &phase_options[phase]);
+            break;
+    }
+}
+
+// Repeats a phase until it has run for the given time, so that short phases
+// are not dominated by noise, and returns the average time of a run
+static double time_phase(PhaseRunner* runner, Phase phase, double min_time) {
+    size_t run_count = 0;
+    double begin = get_time(), time;
+    do {
+        run_phase(runner, phase);
+        run_count++;
+    } while ((time = get_time() - begin) < min_time);
+    return time / run_count;
+}
+
+// Runs every phase, and keeps the fastest time of each phase. Code is only
+// generated for valid specs, so that phases which did not run keep a negative
+// time.
+static void run_phases(const char* file_name, const StrBuf* spec, double min_phase_time, double* times) {
+    PhaseRunner runner = {
+        .spec = spec,
+        .range = {
+            .file_name = file_name,
+            .begin = { .row = 1, .col = 1, .bytes = 0 },
+            .end = { .bytes = spec->size }
+        },
+        .mem_pool = new_mem_pool(),
+        .log = make_log(),
+        .output = make_str_buf()
+    };
+    double phase_times[PHASE_COUNT];
+    for (size_t i = 0; i < PHASE_COUNT; ++i)
+        phase_times[i] = -1;
+
+    phase_times[PHASE_LEX] = time_phase(&runner, PHASE_LEX, min_phase_time);
+    phase_times[PHASE_PARSE] = time_phase(&runner, PHASE_PARSE, min_phase_time);
+    if (runner.syntax->tag == SYNTAX_ROOT)
+        phase_times[PHASE_CHECK] = time_phase(&runner, PHASE_CHECK, min_phase_time);
+    if (runner.log.error_count == 0) {
+        phase_times[PHASE_GRAMMAR] = time_phase(&runner, PHASE_GRAMMAR, min_phase_time);
+        runner.profile = make_test_profile(runner.grammar);
+        for (size_t i = PHASE_PROFILE; i < PHASE_COUNT && runner.log.error_count == 0; ++i)
+            phase_times[i] = time_phase(&runner, i, min_phase_time);
+        free(runner.profile.entries);
+    }
+    free_str_buf(&runner.output);
+    free_log(&runner.log);
+    free_mem_pool(&runner.mem_pool);
+
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        if (times[i] < 0 || (phase_times[i] >= 0 && phase_times[i] < times[i]))
+            times[i] = phase_times[i];
+    }
+}
+
+// Keeps the fastest times seen so far, which start negative. Runs at both
+// sizes are interleaved, so that a slowdown of the machine that lasts for
+// several runs affects both sizes alike.
+static void measure(const char* file_name, const StrBuf* spec, const StrBuf* double_spec, double* times, double* double_times) {
+    for (size_t i = 0; i < RUN_COUNT; ++i) {
+        run_phases(file_name, spec, MIN_PHASE_TIME, times);
+        run_phases(file_name, double_spec, MIN_PHASE_TIME, double_times);
+    }
+}
+
+static double get_total_time(const double* times) {
+    double total = 0;
+    for (size_t i = 0; i < PHASE_COUNT; ++i)
+        total += times[i] > 0 ? times[i] : 0;
+    return total;
+}
+
+// Finds a size for which a run is long enough to be measured reliably
+static size_t find_count(const char* file_name, const char* tmpl, StrBuf* spec) {
+    size_t count = 64;
+    while (true) {
+        instantiate(spec, tmpl, count);
+        double times[PHASE_COUNT];
+        for (size_t i = 0; i < PHASE_COUNT; ++i)
+            times[i] = -1;
+        run_phases(file_name, spec, 0, times);
+        if (get_total_time(times) >= MIN_RUN_TIME || spec->size * 2 > MAX_SPEC_SIZE)
+            return count;
+        count *= 2;
+    }
+}
+
+static bool is_bounded(double time, double double_time, double max_ratio) {
+    return time < 0 || double_time < 0 || double_time <= time * max_ratio + TIME_SLACK;
+}
+
+static bool check_spec(const char* file_name, double max_ratio) {
+    size_t tmpl_size = 0;
+    char* tmpl = read_file(file_name, &tmpl_size);
+    if (!tmpl) {
+        fprintf(stderr, "cannot open '%s'\n", file_name);
+        return false;
+    }
+
+    StrBuf spec = make_str_buf(), double_spec = make_str_buf();
+    size_t count = find_count(file_name, tmpl, &spec);
+    double times[PHASE_COUNT], double_times[PHASE_COUNT];
+
+    // A phase that looks unbounded is measured again at twice the size before
+    // failing, so that a slowdown specific to one size, such as from the memory
+    // layout, is not repeated.
+    bool ok = false;
+    for (size_t attempt = 0; attempt < MAX_ATTEMPTS && !ok; ++attempt) {
+        if (attempt > 0) {
+            count *= 2;
+            instantiate(&spec, tmpl, count);
+        }
+        instantiate(&double_spec, tmpl, count * 2);
+        for (size_t i = 0; i < PHASE_COUNT; ++i)
+            times[i] = double_times[i] = -1;
+        measure(file_name, &spec, &double_spec, times, double_times);
+        ok = true;
+        for (size_t i = 0; i < PHASE_COUNT; ++i)
+            ok &= is_bounded(times[i], double_times[i], max_ratio);
+    }
+
+    printf("%s: n = %zu (%zu bytes), 2n = %zu (%zu bytes)\n", file_name, count, spec.size, count * 2, double_spec.size);
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        if (times[i] < 0 || double_times[i] < 0)
+            continue;
+        printf("  %-8s %10.3f ms %10.3f ms  x%.2f%s\n", phase_names[i],
+            times[i] * 1e3, double_times[i] * 1e3,
+            times[i] > 0 ? double_times[i] / times[i] : 0,
+            is_bounded(times[i], double_times[i], max_ratio) ? "" : "  FAILED");
+    }
+    free_str_buf(&spec);
+    free_str_buf(&double_spec);
+    free(tmpl);
+    return ok;
+}
+
+static double time_parse(const char* file_name, const StrBuf* spec, size_t thread_count) {
+    SourceRange range = {
+        .file_name = file_name,
+        .begin = { .row = 1, .col = 1, .bytes = 0 },
+        .end = { .bytes = spec->size }
+    };
+    double best_time = -1;
+    for (size_t i = 0; i < RUN_COUNT; ++i) {
+        MemPool mem_pool = new_mem_pool();
+        Log log = make_log();
+        double begin = get_time();
+        Lexer lexer = make_range_lexer(spec->data, &range);
+        Parser parser = make_parser(&mem_pool, &lexer, &log);
+        parser.thread_count = thread_count;
+        parse(&parser);
+        double time = get_time() - begin;
+        free_log(&log);
+        free_mem_pool(&mem_pool);
+        if (best_time < 0 || time < best_time)
+            best_time = time;
+    }
+    return best_time;
+}
+
+static double time_compile(const char* file_name, const StrBuf* spec, size_t thread_count) {
+    CodegenOptions options = { .target = TARGET_C, .parse_threads = thread_count };
+    StrBuf output = make_str_buf();
+    double best_time = -1;
+    for (size_t i = 0; i < RUN_COUNT; ++i) {
+        Log log = make_log();
+        output.size = 0;
+        double begin = get_time();
+        compile_spec(file_name, spec->data, spec->size, &options, &output, &log);
+        double time = get_time() - begin;
+        free_log(&log);
+        if (best_time < 0 || time < best_time)
+            best_time = time;
+    }
+    free_str_buf(&output);
+    return best_time;
+}
+
+// Reports the speedups of parsing, and of the whole compilation to C, on 1 to
+// `max_threads` threads, compared to a single thread
+static bool bench_threads(const char* file_name, size_t max_threads) {
+    size_t tmpl_size = 0;
+    char* tmpl = read_file(file_name, &tmpl_size);
+    if (!tmpl) {
+        fprintf(stderr, "cannot open '%s'\n", file_name);
+        return false;
+    }
+
+    StrBuf spec = make_str_buf();
+    size_t count = 64;
+    for (instantiate(&spec, tmpl, count); spec.size < BENCH_SPEC_SIZE; instantiate(&spec, tmpl, count))
+        count *= 2;
+    printf("%s: n = %zu (%zu bytes)\n", file_name, count, spec.size);
+    printf("  threads      parse  speedup    compile  speedup\n");
+    double parse_time = 0, compile_time = 0;
+    for (size_t i = 1; i <= max_threads; ++i) {
+        double cur_parse_time = time_parse(file_name, &spec, i);
+        double cur_compile_time = time_compile(file_name, &spec, i);
+        if (i == 1)
+            parse_time = cur_parse_time, compile_time = cur_compile_time;
+        printf("  %7zu %7.1f ms    x%.2f %7.1f ms    x%.2f\n", i,
+            cur_parse_time * 1e3, parse_time / cur_parse_time,
+            cur_compile_time * 1e3, compile_time / cur_compile_time);
+    }
+    free_str_buf(&spec);
+    free(tmpl);
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: docoptc_perf [options] template.txt...\n"
+        "options:\n"
+        "  -r  --max-ratio <r>  Maximum growth of the time of each phase when the\n"
+        "                       size of a spec doubles (default: 3).\n"
+        "  -j  --threads <n>    Reports the speedups of parsing large instances on\n"
+        "                       1 to n threads instead.\n");
+}
+
+int main(int argc, char** argv) {
+    double max_ratio = 3;
+    size_t max_threads = 0;
+    int first_file = 1;
+    for (; first_file < argc && argv[first_file][0] == '-'; ++first_file) {
+        const char* arg = argv[first_file];
+        if ((!strcmp(arg, "-r") || !strcmp(arg, "--max-ratio")) && first_file + 1 < argc) {
+            char* end = NULL;
+            max_ratio = strtod(argv[++first_file], &end);
+            if (*end || max_ratio < 2) {
+                fprintf(stderr, "invalid ratio '%s'\n", argv[first_file]);
+                return 1;
+            }
+        } else if ((!strcmp(arg, "-j") || !strcmp(arg, "--threads")) && first_file + 1 < argc) {
+            char* end = NULL;
+            max_threads = strtoul(argv[++first_file], &end, 10);
+            if (*end || max_threads == 0) {
+                fprintf(stderr, "invalid thread count '%s'\n", argv[first_file]);
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (first_file == argc) {
+        usage();
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = first_file; i < argc; ++i)
+        ok &= max_threads > 0 ? bench_threads(argv[i], max_threads) : check_spec(argv[i], max_ratio);
+    return ok ? 0 : 1;
+}